@@ -108,15 +108,20 @@ const Search = ({state, dispatch}) => {
     </div>
     {state.searchResults.length > 0 &&
       <div className="search__results">
-        {state.searchResults.map((article, i) => <div key={article.fileName}>
+        {state.searchResults.map((result, i) => <div key={result.type === 'zettel' ? result.id : result.fileName}>
           {i !== 0 && <div className="search__result-divider" />}
-          <a
-            className="search__result"
-            href={`/wiki/${article.slug}`}
-            data-z-article-name={article.title}
-          >
-            {article.title}
-          </a>
+          {result.type === 'zettel'
+            ? <span className="search__result">
+              [{result.id}] {result.title}
+            </span>
+            : <a
+              className="search__result"
+              href={`/wiki/${result.slug}`}
+              data-z-article-name={result.title}
+            >
+              {result.title}
+            </a>
+          }
         </div>)}
       </div>
     }
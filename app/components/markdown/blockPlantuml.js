@@ -1,6 +1,7 @@
 // Process block-level uml diagrams
 
 const plantumlEncoder = require("plantuml-encoder");
+const { cachedRender } = require("./cache");
 
 module.exports = function umlPlugin(md, options) {
 
@@ -8,7 +9,7 @@ module.exports = function umlPlugin(md, options) {
     var imageFormat = pluginOptions.imageFormat || 'img';
     var diagramName = pluginOptions.diagramName || 'uml';
     var server = pluginOptions.server || 'https://www.plantuml.com/plantuml';
-    var zippedCode = plantumlEncoder.encode(umlCode);
+    var zippedCode = cachedRender('plantuml', '', umlCode, plantumlEncoder.encode);
 
     return server + '/' + imageFormat + '/' + zippedCode;
   }
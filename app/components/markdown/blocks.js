@@ -0,0 +1,124 @@
+/*
+ * Render markdown one top-level block at a time, reusing the html of blocks
+ * whose source didn't change.
+ *
+ * The whole source is still parsed, but parsing is cheap compared to
+ * rendering math, diagrams and highlighted code. Blocks are rendered with
+ * line numbers relative to their first line, so a block moved by an edit
+ * above it is still found in the cache.
+ */
+
+const DEFAULT_MAX_ENTRIES = 2000
+
+// footnotes are numbered and tocs collect headings across the document
+const UNCACHEABLE_RE = /^(footnote|toc)/
+// formulas also depend on the macros defined before them, see katex.js
+const MATH_RE = /^math_/
+
+const hasToken = (tokens, re) => tokens.some(token =>
+  re.test(token.type) ||
+  (token.children && token.children.some(child => re.test(child.type)))
+)
+
+const isCacheable = (tokens) => tokens[0].map && !hasToken(tokens, UNCACHEABLE_RE)
+
+// anchors and other plugins set attributes while parsing
+const attrsSignature = (tokens) => tokens
+  .map(token => token.attrs ? JSON.stringify(token.attrs) : '')
+  .join('\n')
+
+const shiftLines = (html, offset) => offset === 0
+  ? html
+  : html.replace(/data-source-line="(\d+)"/g, (_, line) => `data-source-line="${Number(line) + offset}"`)
+
+/**
+ * Blocks rendered by the server (see src/server/render.ts), filling in the
+ * html it left out from `known`, key -> block received before. Null when one
+ * of them isn't known.
+ */
+export const receiveBlocks = (known, blocks) => {
+  const received = []
+  for (const block of blocks) {
+    if (block.html !== undefined) {
+      received.push(block)
+      continue
+    }
+    const old = known.get(block.key)
+    if (!old) {
+      return null
+    }
+    received.push({key: block.key, start: block.start, html: shiftLines(old.html, block.start - old.start)})
+  }
+  return received
+}
+
+/**
+ * Split the tokens of a document into top-level blocks
+ */
+export const splitBlocks = (tokens) => {
+  const blocks = []
+  let start = 0
+  tokens.forEach((token, i) => {
+    if (token.level === 0 && token.nesting !== 1) {
+      blocks.push(tokens.slice(start, i + 1))
+      start = i + 1
+    }
+  })
+  if (start < tokens.length) {
+    blocks.push(tokens.slice(start))
+  }
+  return blocks
+}
+
+export const createBlockRenderer = (md, {maxEntries = DEFAULT_MAX_ENTRIES} = {}) => {
+  // source -> html, in least recently used order
+  const cache = new Map()
+
+  // blocks without a line map start where the previous one did, so starts
+  // stay sorted
+  const renderBlock = (tokens, lines, env, previousStart) => {
+    if (!isCacheable(tokens)) {
+      const start = tokens[0].map ? tokens[0].map[0] : previousStart
+      return {key: null, start, html: md.renderer.render(tokens, md.options, env)}
+    }
+
+    const [start, end] = tokens[0].map
+    const mathKey = md.mathKey && hasToken(tokens, MATH_RE) ? md.mathKey() : ''
+    const key = `${lines.slice(start, end).join('\n')}\0${attrsSignature(tokens)}\0${mathKey}`
+    let html = cache.get(key)
+    if (html === undefined) {
+      tokens.forEach(token => {
+        if (token.map) {
+          token.map = [token.map[0] - start, token.map[1] - start]
+        }
+      })
+      html = md.renderer.render(tokens, md.options, env)
+      if (cache.size >= maxEntries) {
+        cache.delete(cache.keys().next().value)
+      }
+    } else {
+      cache.delete(key)
+    }
+    cache.set(key, html)
+
+    return {key, start, html: shiftLines(html, start)}
+  }
+
+  /**
+   * Html of `src` and of each of its top-level blocks
+   */
+  return (src) => {
+    const env = {}
+    const tokens = md.parse(src, env)
+    const lines = src.split('\n')
+    const blocks = []
+    splitBlocks(tokens).forEach(block => {
+      blocks.push(renderBlock(block, lines, env, blocks.length > 0 ? blocks[blocks.length - 1].start : 0))
+    })
+
+    return {
+      html: blocks.map(block => block.html).join(''),
+      blocks,
+    }
+  }
+}
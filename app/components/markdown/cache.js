@@ -0,0 +1,137 @@
+/*
+ * Output of formula and diagram renderers keyed by (renderer, options, source).
+ *
+ * Entries live in memory in least recently used order and, when the browser
+ * has IndexedDB, are written behind to it so they survive a reload.
+ */
+
+const MAX_ENTRIES = 5000
+const DB_NAME = 'zortex-render-cache'
+// bumped when stored outputs may be stale, which clears them
+const DB_VERSION = 2
+const DB_STORE = 'entries'
+const FLUSH_DELAY = 1000
+
+// key -> output
+const entries = new Map()
+// writes and deletes (null) not flushed to IndexedDB yet
+const pending = new Map()
+let flushTimer = null
+let db = null
+
+const cacheKey = (renderer, options, source) => `${renderer}\0${options}\0${source}`
+
+const scheduleFlush = () => {
+  if (!db || flushTimer) {
+    return
+  }
+  flushTimer = setTimeout(() => {
+    flushTimer = null
+    const transaction = db.transaction(DB_STORE, 'readwrite')
+    const store = transaction.objectStore(DB_STORE)
+    const now = Date.now()
+    pending.forEach((output, key) => {
+      if (output === null) {
+        store.delete(key)
+      } else {
+        store.put({output, used: now}, key)
+      }
+    })
+    pending.clear()
+  }, FLUSH_DELAY)
+}
+
+const set = (key, output) => {
+  entries.delete(key)
+  entries.set(key, output)
+  pending.set(key, output)
+  if (entries.size > MAX_ENTRIES) {
+    const oldest = entries.keys().next().value
+    entries.delete(oldest)
+    pending.set(oldest, null)
+  }
+  scheduleFlush()
+}
+
+const openDb = () => new Promise((resolve, reject) => {
+  const request = indexedDB.open(DB_NAME, DB_VERSION)
+  request.onupgradeneeded = () => {
+    // 1: katex keys didn't include the macros
+    if (request.result.objectStoreNames.contains(DB_STORE)) {
+      request.result.deleteObjectStore(DB_STORE)
+    }
+    request.result.createObjectStore(DB_STORE)
+  }
+  request.onsuccess = () => resolve(request.result)
+  request.onerror = () => reject(request.error)
+})
+
+// Fill the memory cache from IndexedDB, most recently used entries last
+const load = async () => {
+  const database = await openDb()
+  const stored = await new Promise((resolve, reject) => {
+    const results = []
+    const request = database.transaction(DB_STORE).objectStore(DB_STORE).openCursor()
+    request.onsuccess = () => {
+      const cursor = request.result
+      if (cursor) {
+        results.push({key: cursor.key, ...cursor.value})
+        cursor.continue()
+      } else {
+        resolve(results)
+      }
+    }
+    request.onerror = () => reject(request.error)
+  })
+
+  stored.sort((a, b) => a.used - b.used)
+  stored.slice(0, Math.max(stored.length - MAX_ENTRIES, 0)).forEach(({key}) => pending.set(key, null))
+  stored.slice(-MAX_ENTRIES).forEach(({key, output}) => {
+    // entries rendered meanwhile are newer
+    if (!entries.has(key)) {
+      entries.set(key, output)
+    }
+  })
+  while (entries.size > MAX_ENTRIES) {
+    entries.delete(entries.keys().next().value)
+  }
+
+  db = database
+  scheduleFlush()
+}
+
+// also available in the render worker
+if (typeof indexedDB !== 'undefined') {
+  load().catch(e => console.error('Render cache: ', e))
+}
+
+/**
+ * Cached output of `render(source)`, `options` must be a string identifying
+ * the renderer options. Outputs of renders which throw aren't cached.
+ */
+export const cachedRender = (renderer, options, source, render) => {
+  let output = getRendered(renderer, options, source)
+  if (output === undefined) {
+    output = render(source)
+    setRendered(renderer, options, source, output)
+  }
+  return output
+}
+
+/**
+ * Cached output of a renderer which fills elements asynchronously,
+ * undefined when `source` wasn't rendered yet
+ */
+export const getRendered = (renderer, options, source) => {
+  const key = cacheKey(renderer, options, source)
+  const output = entries.get(key)
+  if (output !== undefined) {
+    entries.delete(key)
+    entries.set(key, output)
+  }
+  return output
+}
+
+export const setRendered = (renderer, options, source, output) => {
+  set(cacheKey(renderer, options, source), output)
+}
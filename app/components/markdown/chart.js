@@ -1,7 +1,8 @@
 import Chart from 'chart.js'
+import {findAll} from '../utils'
 
-function render () {
-  document.querySelectorAll('.chartjs').forEach(element => {
+function render (roots) {
+  findAll('.chartjs', roots).forEach(element => {
     try {
       // eslint-disable-next-line no-new
       new Chart(element, JSON.parse(element.textContent))
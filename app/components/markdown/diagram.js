@@ -1,3 +1,6 @@
+import {findAll} from '../utils'
+import {getRendered, setRendered} from './cache'
+
 let options = {}
 
 const diagram = (md, opts = {}) => {
@@ -17,14 +20,22 @@ const diagram = (md, opts = {}) => {
   }
 }
 
-export const renderDiagram = () => {
-  let list = document.querySelectorAll('.sequence-diagrams')
+export const renderDiagram = (roots) => {
+  let list = findAll('.sequence-diagrams', roots)
   if (!list) {
     return
   }
   list.forEach(item => {
     try {
-      let d = window.Diagram.parse(item.textContent)
+      const source = item.textContent
+      const optionsKey = JSON.stringify(options)
+      const svg = getRendered('sequence-diagrams', optionsKey, source)
+      if (svg !== undefined) {
+        item.className = ''
+        item.innerHTML = svg
+        return
+      }
+      let d = window.Diagram.parse(source)
       item.className = ''
       item.textContent = ''
       d.drawSVG(item, {
@@ -32,6 +43,7 @@ export const renderDiagram = () => {
         ...options
       })
       d = null
+      setRendered('sequence-diagrams', optionsKey, source, item.innerHTML)
     } catch (e) {
       console.error(`Parse Sequence-diagrams Error: ${e}`)
     }
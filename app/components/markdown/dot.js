@@ -1,3 +1,6 @@
+import {findAll} from '../utils'
+import {getRendered, setRendered} from './cache'
+
 let options = {}
 
 const dot = (md, opts = {}) => {
@@ -17,16 +20,23 @@ const dot = (md, opts = {}) => {
     }
 }
 
-export const renderDot = () => {
-    let list = document.querySelectorAll('.dot')
-    if (!list) {
+export const renderDot = (roots) => {
+    let list = findAll('.dot', roots)
+    if (list.length === 0) {
         return
     }
     var viz = new Viz();
     list.forEach(item => {
-        viz.renderSVGElement(item.textContent).then(function (e) {
+        const source = item.textContent
+        const svg = getRendered('dot', '', source)
+        if (svg !== undefined) {
+            item.innerHTML = svg
+            return
+        }
+        viz.renderSVGElement(source).then(function (e) {
             item.textContent = ''
             item.appendChild(e)
+            setRendered('dot', '', source, item.innerHTML)
         })
             .catch(e => {
                 var viz = new Viz();
@@ -1,3 +1,6 @@
+import {findAll} from '../utils'
+import {getRendered, setRendered} from './cache'
+
 let options = {}
 
 const flowchart = (md, opts = {}) => {
@@ -17,18 +20,27 @@ const flowchart = (md, opts = {}) => {
   }
 }
 
-export const renderFlowchart = () => {
-  let list = document.querySelectorAll('div.flowchart')
+export const renderFlowchart = (roots) => {
+  let list = findAll('div.flowchart', roots)
   if (!list) {
     return
   }
   list.forEach(item => {
     try {
-      let d = window.flowchart.parse(item.textContent);
+      const source = item.textContent
+      const optionsKey = JSON.stringify(options)
+      const svg = getRendered('flowchart', optionsKey, source)
+      if (svg !== undefined) {
+        item.className = ''
+        item.innerHTML = svg
+        return
+      }
+      let d = window.flowchart.parse(source);
       item.className = ''
       item.textContent = ''
       d.drawSVG(item, options);
       d = null
+      setRendered('flowchart', optionsKey, source, item.innerHTML)
     } catch (e) {
       console.error(`Parse flowchart Error: ${e}`)
     }
@@ -1,6 +1,9 @@
 export { default as initMarkdown } from './init.js'
+export { createBlockRenderer, receiveBlocks } from './blocks'
+export { createWorkerRenderer } from './renderer'
 export { default as chart } from './chart'
 export { renderDiagram } from './diagram'
 export { renderFlowchart } from './flowchart'
 export { renderDot } from './dot'
+export { renderGraphics } from './render'
 
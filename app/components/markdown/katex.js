@@ -10,6 +10,8 @@ for rendering output.
 /* jslint node: true */
 'use strict'
 
+import { cachedRender } from './cache'
+
 // Test if potential opening or closing delimieter
 // Assumes that there is a "$" at state.src[pos]
 function isValidDelim (state, pos) {
@@ -153,11 +155,40 @@ function math_block (state, start, end, silent) {
   return true
 }
 
+// formulas defining macros change how the following ones render
+const DEFINES_MACROS_RE = /\\(?:[gex]?def|let|futurelet|global|(?:re)?newcommand|providecommand)(?![a-zA-Z])/
+
+// a macro as katex keeps it, a string or the tokens of a definition
+const macroText = (value) => value && typeof value === 'object'
+  ? `${value.numArgs || 0}:${(value.tokens || []).map(token => token.text).join(' ')}`
+  : String(value)
+
+const macrosKey = (macros) => Object.keys(macros)
+  .sort()
+  .map(name => `${name}=${macroText(macros[name])}`)
+  .join('\0')
+
 export default function math_plugin (md, options) {
   // Default options
 
   options = options || {}
   options.macros = options.macros || {}
+  const baseKey = JSON.stringify({...options, macros: undefined})
+  // options and macros defined so far, katex adds \gdef and the like to
+  // options.macros
+  let optionsKey = `${baseKey}\0${macrosKey(options.macros)}`
+
+  // formulas defining macros always run, so their macros are defined
+  const render = (renderer, latex, opt) => {
+    if (!DEFINES_MACROS_RE.test(latex)) {
+      return cachedRender(renderer, optionsKey, latex, () => katex.renderToString(latex, opt))
+    }
+    try {
+      return katex.renderToString(latex, opt)
+    } finally {
+      optionsKey = `${baseKey}\0${macrosKey(options.macros)}`
+    }
+  }
 
   // set KaTeX as the renderer for markdown-it-simplemath
   var katexInline = function (latex) {
@@ -168,7 +199,7 @@ export default function math_plugin (md, options) {
       opt.displayMode = false
     }
     try {
-      return katex.renderToString(latex, opt)
+      return render('katex-inline', latex, opt)
     } catch (error) {
       if (opt.throwOnError) { console.log(error) }
       return latex
@@ -187,7 +218,7 @@ export default function math_plugin (md, options) {
       opt.displayMode = true
     }
     try {
-      return '<p>' + katex.renderToString(latex, opt) + '</p>'
+      return '<p>' + render('katex-block', latex, opt) + '</p>'
     } catch (error) {
       if (opt.throwOnError) { console.log(error) }
       return latex
@@ -204,4 +235,6 @@ export default function math_plugin (md, options) {
   })
   md.renderer.rules.math_inline = inlineRenderer
   md.renderer.rules.math_block = blockRenderer
+  // for caches of html containing formulas, see blocks.js
+  md.mathKey = () => optionsKey
 }
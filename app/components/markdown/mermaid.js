@@ -5,8 +5,9 @@ import {escape} from '../utils';
 */
 const mermaidChart = (code) => {
   try {
+    // mermaid isn't loaded in the render worker, mermaid.init reports errors then
     // eslint-disable-next-line
-    mermaid.parse(code)
+    if (typeof mermaid !== 'undefined') mermaid.parse(code)
     return `<div class="mermaid">${escape(code)}</div>`
   } catch ({ str, hash }) {
     return `<pre>${str}</pre>`
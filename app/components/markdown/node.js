@@ -0,0 +1,13 @@
+/*
+ * Render pipeline of the node server in server render mode, bundled into
+ * lib/markdown.js by `yarn build-render`, see src/server/render.ts
+ */
+import katex from '../../_static/katex@0.15.3.js'
+import '../../_static/mhchem.min.js'
+import initMarkdown from './init'
+import { createBlockRenderer } from './blocks'
+
+// the katex plugin uses the global, as on the page and in the render worker
+globalThis.katex = katex
+
+export { initMarkdown, createBlockRenderer }
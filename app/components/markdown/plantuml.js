@@ -1,10 +1,11 @@
 const plantumlEncoder = require("plantuml-encoder");
+import { cachedRender } from './cache'
 
 function generateSourceDefault (umlCode, pluginOptions) {
   var imageFormat = pluginOptions.imageFormat || 'img'
   var diagramName = pluginOptions.diagramName || 'uml'
   var server = pluginOptions.server || 'https://www.plantuml.com/plantuml'
-  var zippedCode = plantumlEncoder.encode(umlCode)
+  var zippedCode = cachedRender('plantuml', '', umlCode, plantumlEncoder.encode)
 
   return server + '/' + imageFormat + '/' + zippedCode
 }
@@ -0,0 +1,45 @@
+import chart from './chart'
+import { renderDiagram } from './diagram'
+import { renderFlowchart } from './flowchart'
+import { renderDot } from './dot'
+import { findAll } from '../utils'
+import { getRendered, setRendered } from './cache'
+
+const renderMermaid = (roots, options) => {
+  const optionsKey = JSON.stringify(options)
+  const elements = []
+  findAll('.mermaid', roots).forEach(element => {
+    const svg = getRendered('mermaid', optionsKey, element.textContent)
+    if (svg === undefined) {
+      elements.push({element, source: element.textContent})
+    } else {
+      element.innerHTML = svg
+      element.setAttribute('data-processed', 'true')
+    }
+  })
+  if (elements.length === 0) {
+    return
+  }
+
+  // eslint-disable-next-line
+  mermaid.initialize(options)
+  // eslint-disable-next-line
+  mermaid.init(undefined, elements.map(({element}) => element))
+  elements.forEach(({element, source}) => {
+    if (element.querySelector('svg')) {
+      setRendered('mermaid', optionsKey, source, element.innerHTML)
+    }
+  })
+}
+
+// Run the renderers which need the DOM on `roots`, the whole document by default
+export const renderGraphics = (roots, options = {}) => {
+  try {
+    renderMermaid(roots, options.maid || {})
+  } catch (e) {}
+
+  chart.render(roots)
+  renderDiagram(roots)
+  renderFlowchart(roots)
+  renderDot(roots)
+}
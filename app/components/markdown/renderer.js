@@ -0,0 +1,93 @@
+import initMarkdown from './init'
+import { createBlockRenderer } from './blocks'
+
+/*
+ * Render markdown blocks in a Web Worker so parsing and typesetting don't
+ * block scrolling.
+ *
+ * At most one render is in flight. Content arriving meanwhile replaces any
+ * content still waiting, and the in-flight result is dropped once newer
+ * content is waiting. Without worker support, or when the worker fails,
+ * rendering falls back to the main thread.
+ */
+
+export const createWorkerRenderer = () => {
+  let mainRender = null
+  const renderOnMainThread = (src) => {
+    if (!mainRender) {
+      mainRender = createBlockRenderer(initMarkdown())
+    }
+    return mainRender(src).blocks
+  }
+
+  let worker = null
+  try {
+    worker = new Worker(new URL('./worker.js', import.meta.url))
+  } catch (e) {}
+
+  let nextId = 0
+  // render sent to the worker
+  let inFlight = null
+  // newest content waiting for the worker
+  let waiting = null
+
+  const post = (request) => {
+    inFlight = {...request, id: ++nextId}
+    worker.postMessage({id: inFlight.id, src: request.src})
+  }
+
+  const finish = (blocks) => {
+    const {resolve} = inFlight
+    inFlight = null
+    if (waiting) {
+      // superseded while rendering
+      resolve(null)
+      const next = waiting
+      waiting = null
+      post(next)
+    } else {
+      resolve(blocks)
+    }
+  }
+
+  if (worker) {
+    worker.onmessage = ({data}) => {
+      if (!inFlight || data.id !== inFlight.id) {
+        return
+      }
+      finish(data.error ? renderOnMainThread(inFlight.src) : data.blocks)
+    }
+    worker.onerror = (e) => {
+      console.error('Render worker: ', e.message)
+      worker.terminate()
+      worker = null
+
+      // only the newest request is still wanted
+      const requests = [inFlight, waiting].filter(request => request)
+      inFlight = null
+      waiting = null
+      requests.forEach((request, i) => {
+        request.resolve(i === requests.length - 1 ? renderOnMainThread(request.src) : null)
+      })
+    }
+  }
+
+  /**
+   * Rendered blocks of `src`, null when newer content superseded it
+   */
+  return (src) => {
+    if (!worker) {
+      return Promise.resolve(renderOnMainThread(src))
+    }
+    return new Promise(resolve => {
+      if (!inFlight) {
+        post({src, resolve})
+        return
+      }
+      if (waiting) {
+        waiting.resolve(null)
+      }
+      waiting = {src, resolve}
+    })
+  }
+}
@@ -0,0 +1,19 @@
+/*
+ * Render worker, see renderer.js
+ */
+import initMarkdown from './init'
+import { createBlockRenderer } from './blocks'
+
+// katex is a global on the page too
+// eslint-disable-next-line
+importScripts('/_static/katex@0.15.3.js', '/_static/mhchem.min.js')
+
+const render = createBlockRenderer(initMarkdown())
+
+self.onmessage = ({ data: { id, src } }) => {
+  try {
+    self.postMessage({ id, blocks: render(src).blocks })
+  } catch (e) {
+    self.postMessage({ id, error: String(e) })
+  }
+}
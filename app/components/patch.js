@@ -0,0 +1,202 @@
+import {findAll} from './utils'
+
+/*
+ * Keep the DOM of `container` in sync with rendered blocks (see
+ * markdown/blocks.js), replacing only the nodes of blocks which changed.
+ *
+ * Blocks are matched by their source, so a block moved by an edit above it
+ * keeps its nodes and only has its `data-source-line` attributes shifted.
+ *
+ * Pages of more than VIRTUAL_MIN_BLOCKS blocks are windowed: only the blocks
+ * near the focused line get their nodes, the others are placeholders of an
+ * estimated height carrying the `data-source-line` of their block, so
+ * scroll sync still finds them. A placeholder is replaced by its block when
+ * it comes near the viewport or when its line is revealed, and `onReveal`
+ * gets the elements added then.
+ */
+
+const VIRTUAL_MIN_BLOCKS = 200
+// blocks rendered on each side of the focused one
+const WINDOW_BLOCKS = 20
+// estimated height of a source line, in px
+const LINE_HEIGHT = 24
+// distance to the viewport at which placeholders are rendered
+const ROOT_MARGIN = '100% 0px'
+
+const toNodes = (html) => {
+  const template = document.createElement('template')
+  template.innerHTML = html
+  return [...template.content.childNodes]
+}
+
+// uncached blocks can only be reused if they rendered the same
+const blockKey = (block) => block.key === null ? `\0${block.html}` : block.key
+
+const elementsOf = (nodes) => nodes.filter(node => node.nodeType === Node.ELEMENT_NODE)
+
+const shiftLines = (nodes, offset) => {
+  findAll('[data-source-line]', elementsOf(nodes)).forEach(element => {
+    element.setAttribute('data-source-line', Number(element.getAttribute('data-source-line')) + offset)
+  })
+}
+
+const createPlaceholder = (start, lines) => {
+  const element = document.createElement('div')
+  element.className = 'zortex-placeholder'
+  element.setAttribute('data-source-line', String(start))
+  element.style.height = `${Math.max(lines, 1) * LINE_HEIGHT}px`
+  return element
+}
+
+// index of the last block starting at or before `line`, blocks are sorted
+// by start
+const blockAt = (blocks, line) => {
+  let lo = 0
+  let hi = blocks.length
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1
+    if (blocks[mid].start <= line) {
+      lo = mid + 1
+    } else {
+      hi = mid
+    }
+  }
+  return Math.max(lo - 1, 0)
+}
+
+export const createBlockPatcher = (container, {onReveal = () => {}} = {}) => {
+  // rendered blocks and their nodes, `html` and `htmlStart` are kept for
+  // blocks shown by a placeholder
+  let current = []
+  // placeholder -> its block
+  const placeholders = new Map()
+
+  // render the placeholder of `block`, return the elements added
+  const reveal = (block) => {
+    if (block.html === null) {
+      return []
+    }
+    const [placeholder] = block.nodes
+    observer.unobserve(placeholder)
+    placeholders.delete(placeholder)
+
+    const nodes = toNodes(block.html)
+    if (block.start !== block.htmlStart) {
+      shiftLines(nodes, block.start - block.htmlStart)
+    }
+    placeholder.replaceWith(...nodes)
+    block.nodes = nodes
+    block.html = null
+    return elementsOf(nodes)
+  }
+
+  const revealAround = (index) => current
+    .slice(Math.max(index - WINDOW_BLOCKS, 0), index + WINDOW_BLOCKS + 1)
+    .flatMap(reveal)
+
+  const observer = typeof IntersectionObserver === 'undefined'
+    ? null
+    : new IntersectionObserver((entries) => {
+      const added = entries
+        .filter(entry => entry.isIntersecting && placeholders.has(entry.target))
+        .flatMap(entry => reveal(placeholders.get(entry.target)))
+      if (added.length > 0) {
+        onReveal(added)
+      }
+    }, {rootMargin: ROOT_MARGIN})
+
+  const release = (block) => {
+    if (block.html !== null) {
+      observer.unobserve(block.nodes[0])
+      placeholders.delete(block.nodes[0])
+    }
+    block.nodes.forEach(node => node.remove())
+  }
+
+  /**
+   * Patch the container to show `blocks`, rendering at least the ones near
+   * `line`, return the elements added
+   */
+  const patch = (blocks, line = 0) => {
+    const next = blocks.map(block => ({key: blockKey(block), start: block.start, nodes: null, html: null, htmlStart: 0}))
+    const virtual = observer !== null && blocks.length > VIRTUAL_MIN_BLOCKS
+    const focus = blockAt(blocks, line)
+
+    const max = Math.min(current.length, next.length)
+    let prefix = 0
+    while (prefix < max && current[prefix].key === next[prefix].key) {
+      prefix++
+    }
+    let suffix = 0
+    while (
+      suffix < max - prefix &&
+      current[current.length - 1 - suffix].key === next[next.length - 1 - suffix].key
+    ) {
+      suffix++
+    }
+
+    // keep unchanged blocks
+    const keep = (old, block) => {
+      block.nodes = old.nodes
+      block.html = old.html
+      block.htmlStart = old.htmlStart
+      if (block.html !== null) {
+        placeholders.set(block.nodes[0], block)
+      }
+    }
+    for (let i = 0; i < prefix; i++) {
+      keep(current[i], next[i])
+    }
+    for (let i = 0; i < suffix; i++) {
+      const old = current[current.length - 1 - i]
+      const block = next[next.length - 1 - i]
+      if (block.start !== old.start) {
+        shiftLines(old.nodes, block.start - old.start)
+      }
+      keep(old, block)
+    }
+
+    // replace changed blocks
+    current.slice(prefix, current.length - suffix).forEach(release)
+    const before = next.slice(next.length - suffix).flatMap(block => block.nodes)[0] || null
+    const added = []
+    for (let i = prefix; i < next.length - suffix; i++) {
+      if (virtual && Math.abs(i - focus) > WINDOW_BLOCKS) {
+        const lines = i + 1 < blocks.length ? blocks[i + 1].start - blocks[i].start : 1
+        const placeholder = createPlaceholder(blocks[i].start, lines)
+        next[i].nodes = [placeholder]
+        next[i].html = blocks[i].html
+        next[i].htmlStart = blocks[i].start
+        placeholders.set(placeholder, next[i])
+        observer.observe(placeholder)
+      } else {
+        next[i].nodes = toNodes(blocks[i].html)
+        added.push(...elementsOf(next[i].nodes))
+      }
+      next[i].nodes.forEach(node => container.insertBefore(node, before))
+    }
+
+    current = next
+    // kept placeholders near the focused line, or all of them once the page
+    // is small enough
+    added.push(...(virtual ? revealAround(focus) : current.flatMap(reveal)))
+    return added
+  }
+
+  return {
+    patch,
+    /**
+     * Render the blocks near `line` if they are placeholders, before
+     * scrolling to it
+     */
+    reveal: (line) => {
+      if (placeholders.size === 0) {
+        return
+      }
+      const added = revealAround(blockAt(current, line))
+      if (added.length > 0) {
+        onReveal(added)
+      }
+    },
+  }
+}
@@ -12,38 +12,72 @@ function scroll (offsetTop) {
   })
 }
 
-function getAttrTag (line) {
-  return `[data-source-line="${line}"]`
+/*
+ * Offsets of the elements rendered for each source line, sorted by line.
+ * Built on the first scroll after a render or a resize, so scrolling
+ * itself neither queries the DOM nor forces a layout.
+ */
+let offsets = null
+
+/**
+ * Drop the offsets, to be called when the rendered content changed or moved
+ */
+export function invalidateOffsets () {
+  offsets = null
 }
 
-function getPreLineOffsetTop (line) {
-  let currentLine = line - 1
-  let ele = null
-  while (currentLine > 0 && !ele) {
-    ele = document.querySelector(getAttrTag(currentLine))
-    if (!ele) {
-      currentLine -= 1
+function getOffsets () {
+  if (!offsets) {
+    const tops = new Map()
+    document.querySelectorAll('[data-source-line]').forEach((ele) => {
+      const line = Number(ele.getAttribute('data-source-line'))
+      // the first element of a line in document order, as querySelector
+      if (!tops.has(line)) {
+        tops.set(line, ele.offsetTop)
+      }
+    })
+    const lines = Int32Array.from(tops.keys()).sort()
+    offsets = {
+      lines,
+      tops: Float64Array.from(lines, (line) => tops.get(line))
     }
   }
-  return [
-    currentLine >= 0 ? currentLine : 0,
-    ele ? ele.offsetTop : 0
-  ]
+  return offsets
 }
 
-function getNextLineOffsetTop (line, len) {
-  let currentLine = line + 1
-  let ele = null
-  while (currentLine < len && !ele) {
-    ele = document.querySelector(getAttrTag(currentLine))
-    if (!ele) {
-      currentLine += 1
+// Index of the first entry whose line isn't less than `line`
+function search (line) {
+  const { lines } = getOffsets()
+  let lo = 0
+  let hi = lines.length
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1
+    if (lines[mid] < line) {
+      lo = mid + 1
+    } else {
+      hi = mid
     }
   }
-  return [
-    currentLine < len ? currentLine : len - 1,
-    ele ? ele.offsetTop : document.documentElement.scrollHeight
-  ]
+  return lo
+}
+
+function getPreLineOffsetTop (line) {
+  // lines before `line`, from 1 on
+  const i = search(line) - 1
+  const { lines, tops } = getOffsets()
+  if (i < 0 || lines[i] < 1) {
+    return [0, 0]
+  }
+  return [lines[i], tops[i]]
+}
+
+function getNextLineOffsetTop (line, len) {
+  const i = search(line + 1)
+  const { lines, tops } = getOffsets()
+  if (i >= lines.length || lines[i] >= len) {
+    return [len - 1, document.documentElement.scrollHeight]
+  }
+  return [lines[i], tops[i]]
 }
 
 function topOrBottom (line, len) {
@@ -56,9 +90,10 @@ function topOrBottom (line, len) {
 
 function relativeScroll (line, ratio, len) {
   let offsetTop = 0
-  const lineEle = document.querySelector(`[data-source-line="${line}"]`)
-  if (lineEle) {
-    offsetTop = lineEle.offsetTop
+  const i = search(line)
+  const { lines, tops } = getOffsets()
+  if (lines[i] === line) {
+    offsetTop = tops[i]
   } else {
     const pre = getPreLineOffsetTop(line)
     const next = getNextLineOffsetTop(line, len)
@@ -1,6 +1,10 @@
-export const escape = (str) => {
-  // escape html content
-  const d = document.createElement('div')
-  d.appendChild(document.createTextNode(str))
-  return d.innerHTML
-}
+const HTML_ESCAPES = {'&': '&amp;', '<': '&lt;', '>': '&gt;'}
+
+// escape html content, also usable without a DOM (e.g. in a worker)
+export const escape = (str) => str.replace(/[&<>]/g, char => HTML_ESCAPES[char])
+
+// elements matching `selector` among `roots` and their descendants
+export const findAll = (selector, roots = [document]) => roots.flatMap(root => [
+  ...(root.matches && root.matches(selector) ? [root] : []),
+  ...root.querySelectorAll(selector),
+])
@@ -2,13 +2,13 @@ import React from 'react'
 import io from 'socket.io-client'
 
 import Layout from '../components/layout'
-import scrollToLine from '../components/scroll'
+import scrollToLine, {invalidateOffsets} from '../components/scroll'
+import {createBlockPatcher} from '../components/patch'
+import {findAll} from '../components/utils'
 import {
-  initMarkdown,
-  chart,
-  renderDiagram,
-  renderFlowchart,
-  renderDot
+  createWorkerRenderer,
+  receiveBlocks,
+  renderGraphics
 } from '../components/markdown'
 
 const defaultContent = `@@Test
@@ -85,7 +85,7 @@ const testRefreshContentParams = {
 const refreshScroll = ({
   winline,
   winheight,
-  content,
+  lineCount,
   cursor,
   isActive,
   options,
@@ -95,35 +95,70 @@ const refreshScroll = ({
       cursor: cursor[1],
       winline,
       winheight,
-      len: content.length,
+      len: lineCount,
     })
   }
 }
 
-const refreshRender = ({newContent, refreshContent, md, state, setState, articleTitle}) => {
-  setState({
-    ...state,
-    title: articleTitle?.title,
-    slug: articleTitle?.slug,
-    // name: ((name) => {
-    //   let tokens = name.split(/\\|\//).pop().split('.')
-    //   return tokens.length > 1 ? tokens.slice(0, -1).join('.') : tokens[0]
-    // })(name),
-    ...(refreshContent ? {content: md.render(newContent)} : {}),
-  })
+// Make article links in `elements` open the article in vim
+const bindArticleLinks = (elements, socket) => {
+  const onPageChange = articleName => socket.emit('change_page', articleName)
+  findAll('[data-z-article-name]', elements)
+    .forEach(elem => {
+      const articleName = elem.getAttribute('data-z-article-name')
+      elem.removeAttribute('data-z-article-name')
+      elem.removeAttribute('href')
+
+      elem.onclick = () => onPageChange(articleName)
+      elem.classList.add('zortex-local-link')
+    })
+}
+
+// links and graphics of elements added to the page
+const processElements = (elements, socket, options) => {
+  invalidateOffsets()
+  bindArticleLinks(elements, socket)
+  renderGraphics(elements, options)
 }
 
-const Buffer = ({md, options, setSlug}) => {
-  const [state, setState] = React.useState({
-    content: [],
+const refreshRender = ({newContent, refreshContent, render, patch, line, socket, options}) => {
+  if (!refreshContent) {
+    return Promise.resolve()
+  }
+  return render(newContent).then(blocks => {
+    // superseded by newer content
+    if (!blocks) {
+      return
+    }
+    // only new or changed blocks near the cursor need links and graphics,
+    // the others get them once scrolled to
+    processElements(patch(blocks, line), socket, options)
   })
+}
+
+const Buffer = ({render, options, setSlug}) => {
+  const container = React.useRef(null)
   const socket = React.useMemo(() => io(), [])
 
   // socket functions
   React.useEffect(() => {
     let timer = undefined
     let preContent = ''
-    let bufferLinksTimer = undefined
+    // bumped by each render, so one finishing late doesn't replace a newer one
+    let renders = 0
+    const {patch, reveal} = createBlockPatcher(container.current, {
+      onReveal: (elements) => processElements(elements, socket, options),
+    })
+    // render the blocks at the cursor before scrolling to them
+    const scrollTo = (props) => {
+      if (props.isActive && !props.options.disable_sync_scroll) {
+        reveal(props.cursor[1] - 1)
+      }
+      refreshScroll(props)
+    }
+    // images loading and window resizes move the rendered lines
+    const resizeObserver = new ResizeObserver(() => invalidateOffsets())
+    resizeObserver.observe(container.current)
 
     const onConnect = () => {}
     const onDisconnect = () => {}
@@ -143,84 +178,109 @@ const Buffer = ({md, options, setSlug}) => {
       const refreshContent = preContent !== newContent
       preContent = newContent
 
-      const refreshRenderProps = {newContent, refreshContent, state, setState, md, articleTitle}
-      const refreshScrollProps = {winline, winheight, content, cursor, isActive, options}
+      const rendered = refreshContent ? ++renders : renders
+      const patchRendered = (blocks, line) => rendered === renders ? patch(blocks, line) : []
+      const refreshRenderProps = {newContent, refreshContent, render, patch: patchRendered, line: cursor[1] - 1, socket, options}
+      const refreshScrollProps = {winline, winheight, lineCount: content.length, cursor, isActive, options}
 
       if (!preContent) {
-        refreshRender(refreshRenderProps)
-        refreshScroll(refreshScrollProps)
+        refreshRender(refreshRenderProps).then(() => scrollTo(refreshScrollProps))
       } else {
         if (!refreshContent) {
-          refreshScroll(refreshScrollProps)
+          scrollTo(refreshScrollProps)
         } else {
           setSlug(articleTitle?.slug)
           if (timer) {
             clearTimeout(timer)
           }
-          if (bufferLinksTimer) {
-            clearTimeout(bufferLinksTimer)
-          }
-
-          // can't reliably get this to work otherwise
-          bufferLinksTimer = setTimeout(() => {
-            const onPageChange = articleName => socket.emit('change_page', articleName)
-            document.querySelectorAll('[data-z-article-name]')
-              .forEach(elem => {
-                const articleName = elem.getAttribute('data-z-article-name')
-                elem.removeAttribute('data-z-article-name')
-                elem.removeAttribute('href')
-
-                elem.onclick = () => onPageChange(articleName)
-                elem.classList.add('zortex-local-link')
-              })
-          }, 1000)
 
           timer = setTimeout(() => {
-            refreshRender(refreshRenderProps)
-            refreshScroll(refreshScrollProps)
+            // scroll once the new content is in place
+            refreshRender(refreshRenderProps).then(() => scrollTo(refreshScrollProps))
           }, 16)
         }
       }
     }
 
+    // lines and version of the last content received from the server, lines
+    // are null once it sends rendered blocks
+    let lines = []
+    let version = null
+    let lineCount = 0
+    // key -> block last rendered by the server
+    let serverBlocks = new Map()
+
+    const onRefreshContent = (data) => {
+      lines = data.content
+      lineCount = lines.length
+      version = data.version
+      refreshContent(data)
+    }
+    const onRefreshPatch = ({patch, baseVersion, ...data}) => {
+      if (!lines || baseVersion !== version) {
+        socket.emit('request_content')
+        return
+      }
+      lines = [...lines]
+      lines.splice(patch.start, patch.deleteCount, ...patch.lines)
+      lineCount = lines.length
+      version = data.version
+      refreshContent({...data, content: lines})
+    }
+    const onRefreshBlocks = ({blocks, baseVersion, ...data}) => {
+      const received = baseVersion === null || baseVersion === version
+        ? receiveBlocks(serverBlocks, blocks)
+        : null
+      if (!received) {
+        socket.emit('request_content')
+        return
+      }
+      serverBlocks = new Map(received.filter(block => block.key !== null).map(block => [block.key, block]))
+      lines = null
+      lineCount = data.lineCount
+      version = data.version
+      // content received as lines again is rendered even if it didn't change
+      preContent = ''
+      renders++
+      clearTimeout(timer)
+
+      setSlug(data.articleTitle?.slug)
+      processElements(patch(received, data.cursor[1] - 1), socket, options)
+      scrollTo({...data, options})
+    }
+    const onRefreshScroll = (data) => {
+      if (data.version !== version) {
+        socket.emit('request_content')
+        return
+      }
+      scrollTo({...data, lineCount, options})
+    }
+
     refreshContent(testRefreshContentParams)
 
     socket.on('connect', onConnect)
     socket.on('disconnect', onDisconnect)
     socket.on('close', onClose)
     socket.on('close_page', onClose)
-    socket.on('refresh_content', refreshContent)
+    socket.on('refresh_content', onRefreshContent)
+    socket.on('refresh_patch', onRefreshPatch)
+    socket.on('refresh_blocks', onRefreshBlocks)
+    socket.on('refresh_scroll', onRefreshScroll)
   }, [])
 
-  React.useEffect(() => {
-    try {
-      // eslint-disable-next-line
-      mermaid.initialize(options.maid || {})
-      // eslint-disable-next-line
-      mermaid.init(undefined, document.querySelectorAll('.mermaid'))
-    } catch (e) {}
-
-    chart.render()
-    renderDiagram()
-    renderFlowchart()
-    renderDot()
-  }, [state.refreshContent])
-
   return (
     <section
       className="markdown-body"
-      dangerouslySetInnerHTML={{
-        __html: state.content,
-      }}
+      ref={container}
     />
   )
 }
 
 export default () => {
-  const md = initMarkdown()
+  const render = React.useMemo(() => createWorkerRenderer(), [])
   const [slug, setSlug] = React.useState(null)
 
   return <Layout articleSlug={slug}>
-    <Buffer md={md} options={{}} setSlug={setSlug} />
+    <Buffer render={render} options={{}} setSlug={setSlug} />
   </Layout>
 }
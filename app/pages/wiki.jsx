@@ -1,65 +1,52 @@
 import React from 'react'
 
 import Layout from '../components/layout'
+import {createBlockPatcher} from '../components/patch'
 import {
-  initMarkdown,
-  chart,
-  renderDiagram,
-  renderFlowchart,
-  renderDot
+  createWorkerRenderer,
+  renderGraphics
 } from '../components/markdown'
 
-const Wiki = ({md}) => {
-  const [state, setState] = React.useState({
-    content: [],
-  })
+const Wiki = () => {
+  const container = React.useRef(null)
 
   React.useEffect(() => {
     const articleName = window.location.pathname.split('/')[2]
+    // long hubs render the blocks out of view once scrolled to
+    const {patch} = createBlockPatcher(container.current, {
+      onReveal: (elements) => renderGraphics(elements),
+    })
 
     fetch(`/wiki/article/${articleName}`, {
       method: 'GET',
     })
       .then(res => res.json())
       .then(data => {
-        if (!data?.content) {
+        if (!data?.content && !data?.blocks) {
           console.error('Could not find article. Received:', data)
+        } else if (data.blocks) {
+          // rendered by the server
+          renderGraphics(patch(data.blocks))
         } else {
-          setState({
-            content: md.render(data.content.join('\n'))
+          createWorkerRenderer()(data.content.join('\n')).then(blocks => {
+            if (blocks) {
+              renderGraphics(patch(blocks))
+            }
           })
         }
       })
   }, [])
 
-  React.useEffect(() => {
-    try {
-      // eslint-disable-next-line
-      mermaid.initialize(options.maid || {})
-      // eslint-disable-next-line
-      mermaid.init(undefined, document.querySelectorAll('.mermaid'))
-    } catch (e) {}
-
-    chart.render()
-    renderDiagram()
-    renderFlowchart()
-    renderDot()
-  }, [])
-
   return (
     <section
       className="markdown-body"
-      dangerouslySetInnerHTML={{
-        __html: state.content,
-      }}
+      ref={container}
     />
   )
 }
 
 export default () => {
-  const md = initMarkdown()
-
   return <Layout>
-    <Wiki md={md} options={{}} />
+    <Wiki options={{}} />
   </Layout>
 }
@@ -153,6 +153,47 @@ function! zortex#article#listitem_to_zettel()
     call setline(".", "[" . l:id . "]" . l:tags . l:lineitem)
 endfunction
 
+" Move ``   - #tag# Line`` to a new zettel of the zettels file, the line is
+" only deleted once the zettel was written
+function! zortex#article#listitem_to_new_zettel() abort
+    let m = matchlist(getline('.'), s:listitemRE)
+    if len(l:m) == 0
+        return
+    endif
+
+    let tags = split(l:m[2], '#')
+    try
+        let zettel = zortex#rpc#create_zettel(l:tags, l:m[3])
+    catch
+        call zortex#util#echo_messages('Error', ['[zortex.nvim]: could not create the zettel: ' . v:exception])
+        return
+    endtry
+
+    if l:zettel is v:null
+        " without the server, append the line to the file directly
+        let id = s:zettel_id()
+        let header = empty(l:tags) ? '[' . l:id . ']' : '[' . l:id . '] ' . l:m[2]
+        let zettels_file = g:zortex_notes_dir . '/zettels' . g:zortex_extension
+        if writefile([l:header . ' ' . l:m[3]], l:zettels_file, 'a') != 0
+            call zortex#util#echo_messages('Error', ['[zortex.nvim]: could not write ' . l:zettels_file])
+            return
+        endif
+        let zettel = {'id': l:id}
+    endif
+
+    " the vim rpc client returns nothing when the request failed
+    if type(l:zettel) != v:t_dict || !has_key(l:zettel, 'id')
+        call zortex#util#echo_messages('Error', ['[zortex.nvim]: could not create the zettel'])
+        return
+    endif
+
+    delete _
+    call zortex#util#echo_messages('Type', '[zortex.nvim]: created zettel ' . l:zettel['id'])
+    if get(b:, 'ZortexPreviewToggleBool', 0)
+        call zortex#rpc#preview_refresh()
+    endif
+endfunction
+
 function! zortex#article#resource_to_zettel(...)
     let m = matchlist(getline('.'), s:listitemRE)
     if len(l:m) == 0
@@ -291,6 +332,15 @@ function s:render_structures(structures, matching_structures)
 endfunction
 
 function s:render_article_structures(article_name)
+    " the server keeps the structures parsed
+    try
+        let lines = zortex#rpc#article_structures(a:article_name)
+        if type(l:lines) == v:t_list
+            return l:lines
+        endif
+    catch /.*/
+    endtry
+
     let [l:structures, l:matching_structures] = zortex#article#get_matching_structures(a:article_name)
     return s:render_structures(l:structures, l:matching_structures)
 endfunction
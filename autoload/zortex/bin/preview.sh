@@ -1,6 +1,30 @@
 #!/usr/bin/bash
-# Preview script for fzf. Replaces \f with \n and pretty prints with bat
+# Preview script for fzf. Reads the note of an fzf line and pretty prints it
+# with bat, keeping the output until the note changes
 
 ext=$1
-body=$2
-tr '\f' '\n' <<< "$body" | bat --color=always --plain --language md
+dir=$2
+line=$3
+
+# the line starts with the creation time of the note, its file name
+time=${line%%$'\f'*}
+basename=$(tr -d ' :-' <<< "$time")$ext
+file=$dir$basename
+
+if [ ! -f "$file" ]; then
+    # not a note, e.g. a line of an older format
+    tr '\f' '\n' <<< "$line" | bat --color=always --plain --language md
+    exit
+fi
+
+cache_dir=${XDG_CACHE_HOME:-$HOME/.cache}/zortex/preview
+cache=$cache_dir/$basename
+if [ ! "$cache" -nt "$file" ]; then
+    mkdir -p "$cache_dir"
+    if ! bat --color=always --plain --language md "$file" > "$cache.$$"; then
+        rm -f "$cache.$$"
+        exit 1
+    fi
+    mv "$cache.$$" "$cache"
+fi
+cat "$cache"
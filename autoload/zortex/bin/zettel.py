@@ -43,16 +43,34 @@ def to_tags(lines):
         return tags
 
 
+def to_excerpt(lines, max_lines=3, max_length=200):
+    """
+    Header tag lines and the first few lines of the body, the preview reads the
+    rest of the file when it is shown
+    """
+    header = []
+    body = []
+    for i, line in enumerate(lines):
+        if len(line) == 0:
+            continue
+        if not tag_re.match(line):
+            body = [line.strip() for line in lines[i:] if len(line.strip()) > 0][:max_lines]
+            break
+        header.append(line)
+
+    excerpt = ' '.join(body)[:max_length]
+    return header + [excerpt] if excerpt else header
+
+
 def to_zettel(path, lines):
     tags = to_tags(lines)
 
-    # Prepare the file for preview
-    lines.insert(0, file_creation(path) + ' ')
+    # Prepare the fzf line: creation time, header tags and an excerpt
     if path.endswith('storage.zortex'):
-        # file = ' \f'.join([*lines[:1], *list(map(lambda tag: tag['text'], tags))])
-        file = ' \f'.join(lines[:3])
+        lines = lines[:2]
     else:
-        file = ' \f'.join(lines)
+        lines = to_excerpt(lines)
+    file = ' \f'.join([file_creation(path) + ' ', *lines])
 
     return {
         'path': path,
@@ -21,6 +21,7 @@ function! s:save_env_variables() abort
     let env_variables = {
                 \ "PORT": g:zortex_remote_wiki_port,
                 \ "EXTENSION": g:zortex_extension,
+                \ "SERVER_RENDER": g:zortex_server_render,
                 \ "NOTES_DIR": g:zortex_remote_server_dir . '/notes'
                 \ }
     let exports = map(items(l:env_variables), {_, x -> x[0].'='.x[1]})
@@ -56,6 +57,16 @@ function! zortex#remote#sync() abort
     return ids
 endfunction
 
+" send only the notes changed since the last sync, through the node server,
+" and apply them to the running remote wiki
+function! zortex#remote#sync_notes() abort
+    if zortex#rpc#sync_remote()
+        return
+    endif
+    " no node server to keep the journal, copy the notes dir
+    call jobwait([s:rsync(g:zortex_notes_dir.'/', g:zortex_remote_server.':'.g:zortex_remote_server_dir.'/notes')])
+endfunction
+
 function! zortex#remote#stop_server() abort
     call s:ssh('fuser -k ' . g:zortex_remote_wiki_port . '/tcp')
 endfunction
@@ -131,6 +131,86 @@ function! zortex#rpc#preview_refresh() abort
   endif
 endfunction
 
+function! s:on_config_change(dict, key, change) abort
+  if get(s:, 'config_channel_id', -1) !=# -1
+    call rpcnotify(s:config_channel_id, 'config_changed', { 'key': a:key })
+  endif
+endfunction
+
+" notify the server when a g:zortex_* variable changes so it can cache them
+" returns 1 if changes can be watched and 0 otherwise
+function! zortex#rpc#watch_config(channel_id) abort
+  if s:is_vim || !exists('*dictwatcheradd')
+    return 0
+  endif
+  let s:config_channel_id = a:channel_id
+  if !get(s:, 'config_watched', 0)
+    call dictwatcheradd(g:, 'zortex_*', function('s:on_config_change'))
+    let s:config_watched = 1
+  endif
+  return 1
+endfunction
+
+" lines of the structures matching `article_name`, v:null when the server isn't running
+function! zortex#rpc#article_structures(article_name) abort
+  if s:is_vim
+    if s:zortex_channel_id !=# v:null
+      return zortex#rpc#request(s:zortex_channel_id, 'article_structures', [a:article_name])
+    endif
+  else
+    if s:zortex_channel_id !=# -1
+      return rpcrequest(s:zortex_channel_id, 'article_structures', a:article_name)
+    endif
+  endif
+  return v:null
+endfunction
+
+" summary lines of the server metrics, v:null when the server isn't running
+function! zortex#rpc#stats() abort
+  if s:is_vim
+    if s:zortex_channel_id !=# v:null
+      return zortex#rpc#request(s:zortex_channel_id, 'stats')
+    endif
+  else
+    if s:zortex_channel_id !=# -1
+      return rpcrequest(s:zortex_channel_id, 'stats')
+    endif
+  endif
+  return v:null
+endfunction
+
+" append a zettel to the zettels file, returns its id and line number, v:null
+" when the server isn't running
+function! zortex#rpc#create_zettel(tags, content) abort
+  if s:is_vim
+    if s:zortex_channel_id !=# v:null
+      return zortex#rpc#request(s:zortex_channel_id, 'create_zettel', [a:tags, a:content])
+    endif
+  else
+    if s:zortex_channel_id !=# -1
+      return rpcrequest(s:zortex_channel_id, 'create_zettel', a:tags, a:content)
+    endif
+  endif
+  return v:null
+endfunction
+
+" send the notes changed since the last sync to the remote wiki
+" returns 1 if the server is running and 0 otherwise
+function! zortex#rpc#sync_remote() abort
+  if s:is_vim
+    if s:zortex_channel_id !=# v:null
+      call zortex#rpc#notify(s:zortex_channel_id, 'sync_remote', {})
+      return 1
+    endif
+  else
+    if s:zortex_channel_id !=# -1
+      call rpcnotify(s:zortex_channel_id, 'sync_remote', {})
+      return 1
+    endif
+  endif
+  return 0
+endfunction
+
 function! zortex#rpc#preview_close() abort
   if s:is_vim
     if s:zortex_channel_id !=# v:null
@@ -21,6 +21,18 @@ let s:bin = { 'preview': s:bin_dir.'preview.sh',
 
 "============================== Helpers ===========================
 
+" fzf source of the notes, listed by the running server when there is one
+function! s:source(...) abort
+    let type = get(a:, 1, '')
+    let source_files = s:bin.source_files . (empty(type) ? '' : ' -t ' . type)
+    if zortex#rpc#get_server_status() !=# 1 || empty(g:zortex_port) || !executable('curl')
+        return source_files
+    endif
+    let url = 'http://127.0.0.1:' . g:zortex_port . '/zortex/source' . (empty(type) ? '' : '?type=' . type)
+    " read the notes when the server doesn't answer
+    return join(['curl', '-sfN', shellescape(url), '||', source_files])
+endfunction
+
 function! s:is_empty(string)
     return match(a:string, "^$") > -1
 endfunction
@@ -145,6 +157,7 @@ endfunction
 
 function! s:parse_fzf_response(lines) abort
     " Convert fzf-preview 'previewbody' to managable 'basename' and 'filebody'
+    " 'filebody' only holds the header tags and an excerpt, read the file for the rest
     function! s:parse_previewbody(previewbody)
         let [filetime; filebody] = a:previewbody
         let TimeToBasename = {time->substitute(time, '[ :-]', '', 'g') . g:zortex_extension}
@@ -291,7 +304,7 @@ let s:fzf_options =
             \     'alt-d:page-down',
             \     'ctrl-w:backward-kill-word',
             \     ], ','),
-            \   '--preview=' . shellescape(join([s:bin.preview, g:zortex_extension, '{}'])),
+            \   '--preview=' . shellescape(join([s:bin.preview, g:zortex_extension, shellescape(g:zortex_notes_dir), '{}'])),
             \   '--preview-window=' . join(filter(copy([
             \       g:zortex_preview_direction,
             \       g:zortex_preview_width,
@@ -315,7 +328,7 @@ function! zortex#search#search()
     call fzf#run(
     \ fzf#wrap(extend(copy(s:zortex_fzf_options), {
     \ 'sink*': function(exists('*zortex_note_handler') ? 'zortex_note_handler' : 'zortex#search#handler'),
-    \ 'source': s:bin.source_files,
+    \ 'source': s:source(),
     \ }), 1))
 endfunction
 
@@ -323,6 +336,6 @@ function! zortex#search#search_unique()
     call fzf#run(
     \ fzf#wrap(extend(copy(s:zortex_fzf_options), {
     \ 'sink*': function(exists('*zortex_note_handler') ? 'zortex_note_handler' : 'zortex#search#handler'),
-    \ 'source': join([s:bin.source_files, '-t', 'unique']),
+    \ 'source': s:source('unique'),
     \ }), 1))
 endfunction
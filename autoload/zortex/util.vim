@@ -16,6 +16,18 @@ function! zortex#util#echo_messages(hl, msgs)
   echohl None
 endfunction
 
+" echo the server metrics
+function! zortex#util#show_stats() abort
+  let l:lines = zortex#rpc#stats()
+  if l:lines is v:null
+    call zortex#util#echo_messages('Error', '[zortex.nvim]: the server is not running')
+  elseif empty(l:lines)
+    call zortex#util#echo_messages('Normal', '[zortex.nvim]: nothing measured yet')
+  else
+    call zortex#util#echo_messages('Normal', l:lines)
+  endif
+endfunction
+
 " echo url
 function! zortex#util#echo_url(url)
   let l:url = 'Preview page: ' . a:url
@@ -30,6 +30,15 @@ call s:def_value('auto_close', 1)
 " move the cursor
 call s:def_value('refresh_slow', 0)
 
+" minimum time in milliseconds between two content refreshes of the preview,
+" cursor moves which don't change the buffer are sent right away
+call s:def_value('refresh_interval', 100)
+
+" set to 1, markdown is rendered by the node server and only the changed
+" blocks are sent, for browsers too slow to render it, e.g. phones on the
+" remote wiki. Needs `yarn build-render`
+call s:def_value('server_render', 0)
+
 " set to 1, the ZortexPreview command can be use for all files,
 " by default it just can be use in markdown file
 call s:def_value('command_for_global', 0)
@@ -134,6 +143,7 @@ function! s:init_command() abort
     " command! ZortexBranchToOutline call zortex#article#branch_to_outline()
     " command! ZortexBranchToArticle call zortex#article#branch_to_article()
     command! -range ZortexListitemToZettel <line1>,<line2> call zortex#article#listitem_to_zettel()
+    command! ZortexListitemToNewZettel call zortex#article#listitem_to_new_zettel()
     command! -range ZortexResourceToZettel <line1>,<line2> call zortex#article#resource_to_zettel(<q-args>)
     command! ZortexOpenStructure call zortex#article#open_structure()
 
@@ -141,9 +151,11 @@ function! s:init_command() abort
     command! ZortexStartRemoteServer call zortex#remote#start_server()
     command! ZortexRestartRemoteServer call zortex#remote#restart_server()
     command! ZortexSyncRemoteServer call zortex#remote#sync()
+    command! ZortexSyncRemoteNotes call zortex#remote#sync_notes()
 
     command! ZortexStartServer call zortex#util#try_start_server()
     command! ZortexStopServer call zortex#rpc#stop_server()
+    command! ZortexStats call zortex#util#show_stats()
     command! -buffer ZortexPreview call zortex#util#open_preview_page()
     command! -buffer ZortexPreviewStop call zortex#util#stop_preview()
     command! -buffer ZortexPreviewToggle call zortex#util#toggle_preview()
@@ -1,17 +1,35 @@
 import {attach, Attach, NeovimClient} from '@chemzqm/neovim'
 import * as path from 'path'
+import {populateHub} from '../zortex/zettel'
+import {appendZettel, getZettels, watchZettels} from '../zortex/store'
+import {getMatchingStructures, getStructureIndex, renderStructures} from '../zortex/structures'
+import {syncNotes} from '../zortex/sync'
+import {getBufferLines} from './mirror'
+import {getConfig, invalidateConfig, RefreshState, watchConfig} from './state'
+import {createScheduler, REFRESH_STAGE, SchedulerStats} from './scheduler'
+import {summarizeMetrics, time} from '../util/metrics'
 
-const zortex = require('../zortex') // tslint:disable-line
 const logger = require('../util/logger')('attach') // tslint:disable-line
 
 interface IApp {
   refreshPage: (param: {data: any}) => void
+  refreshScroll: (param: {data: any}) => void
   openBrowser: (params: {}) => void
 }
 
 export interface IPlugin {
   init: (app: IApp) => void
   nvim: NeovimClient
+  refreshStats: SchedulerStats
+}
+
+function scrollData(state: RefreshState) {
+  return {
+    isActive: true,
+    winline: state.winline,
+    winheight: state.winheight,
+    cursor: state.cursor,
+  }
 }
 
 let app: IApp
@@ -19,44 +37,66 @@ let app: IApp
 export default function (options: Attach): IPlugin {
   const nvim: NeovimClient = attach(options)
 
-  nvim.on('notification', async (method: string, args: any[]) => {
-    const buffer = await nvim.buffer
-    const notesDir = await nvim.getVar('zortex_notes_dir')
-    const extension = await nvim.getVar('zortex_extension')
-    const zettels = await zortex.indexZettels(
-      // @ts-ignore
-      path.join(notesDir, 'zettels' + extension)
-    )
+  // zettels files whose changes invalidate the previewed hub
+  const watchedZettels = new Set<string>()
 
-    if (method === 'refresh_content') {
-      const winline = await nvim.call('winline')
-      const currentWindow = await nvim.window
-      const winheight = await nvim.call('winheight', currentWindow.id)
-      const cursor = await nvim.call('getpos', '.')
-      const renderOpts = await nvim.getVar('zortex_preview_options')
-      const pageTitle = await nvim.getVar('zortex_page_title')
-      const theme = await nvim.getVar('zortex_theme')
-      const name = await buffer.name
-      const bufferLines = await buffer.getLines()
-      const content = await zortex.populateHub(bufferLines, zettels, notesDir)
-      const currentBuffer = await nvim.buffer
+  const scheduler = createScheduler(nvim, {
+    content: async (state) => {
+      const {notesDir, extension} = state.config
+      const zettelsFile = path.join(notesDir, 'zettels' + extension)
+      if (!watchedZettels.has(zettelsFile)) {
+        watchedZettels.add(zettelsFile)
+        // the buffer didn't change but the zettels its queries expand to did
+        watchZettels(zettelsFile, () => scheduler.invalidate())
+      }
+      const [zettels, bufferLines] = await time(REFRESH_STAGE, {stage: 'index', source: 'notify'}, () =>
+        Promise.all([getZettels(zettelsFile), getBufferLines(nvim, state.buffer)])
+      )
+      const content = await time(REFRESH_STAGE, {stage: 'populate', source: 'notify'}, () =>
+        populateHub(bufferLines, zettels, notesDir)
+      )
 
       app?.refreshPage({
         data: {
-          options: renderOpts,
-          isActive: currentBuffer.id === buffer.id,
-          winline,
-          winheight,
-          cursor,
-          pageTitle,
-          theme,
-          name,
+          ...scrollData(state),
+          options: state.config.previewOptions,
+          pageTitle: state.config.pageTitle,
+          theme: state.config.theme,
+          name: state.name,
+          serverRender: !!state.config.serverRender,
           content,
-          zettels,
         },
       })
+    },
+    scroll: (state) => {
+      app?.refreshScroll({data: {...scrollData(state), name: state.name}})
+    },
+  })
+
+  async function syncRemote() {
+    try {
+      const {notesDir} = await getConfig(nvim)
+      const [server, dir, port] = await Promise.all(
+        ['zortex_remote_server', 'zortex_remote_server_dir', 'zortex_remote_wiki_port'].map((name) => nvim.getVar(name))
+      )
+      const {written, deleted} = await syncNotes(notesDir, {server: server as string, dir: dir as string, port: port as string})
+      await nvim.call('zortex#util#echo_messages', ['Type', `[zortex.nvim]: synced ${written} notes, deleted ${deleted}`])
+    } catch (e) {
+      logger.error('sync_remote: ', e)
+      await nvim.call('zortex#util#echo_messages', ['Error', [`[zortex.nvim]: ${e.message}`]])
+    }
+  }
+
+  nvim.on('notification', async (method: string, args: any[]) => {
+    if (method === 'refresh_content') {
+      scheduler.request()
+    } else if (method === 'config_changed') {
+      invalidateConfig()
+      scheduler.invalidate()
     } else if (method === 'open_browser') {
       app?.openBrowser({})
+    } else if (method === 'sync_remote') {
+      syncRemote()
     }
   })
 
@@ -67,9 +107,40 @@ export default function (options: Attach): IPlugin {
   //     resp.send()
   //   })
 
+  nvim.on('request', async (method: string, args: any[], resp: any) => {
+    if (method === 'stats') {
+      resp.send(summarizeMetrics())
+    } else if (method === 'create_zettel') {
+      try {
+        const {notesDir, extension} = await getConfig(nvim)
+        const [tags, content] = args
+        const zettel = await appendZettel(path.join(notesDir, 'zettels' + extension), tags || [], content || '')
+        // the previewed hub may query its tags, so its next refresh populates it again
+        scheduler.invalidate()
+        resp.send(zettel)
+      } catch (e) {
+        logger.error('create_zettel: ', e)
+        resp.send(e.message, true)
+      }
+    } else if (method === 'article_structures') {
+      try {
+        const {notesDir, extension} = await getConfig(nvim)
+        const index = await getStructureIndex(notesDir, extension)
+        resp.send(renderStructures(getMatchingStructures(args[0], index)))
+      } catch (e) {
+        logger.error('article_structures: ', e)
+        resp.send(e.message, true)
+      }
+    } else {
+      // rpcrequest() blocks vim until it gets an answer
+      resp.send(`unknown method: ${method}`, true)
+    }
+  })
+
   nvim.channelId
     .then(async (channelId) => {
       await nvim.setVar('zortex_node_channel_id', channelId)
+      await watchConfig(nvim, channelId)
     })
     .catch((e) => {
       logger.error('channelId: ', e)
@@ -77,6 +148,7 @@ export default function (options: Attach): IPlugin {
 
   return {
     nvim,
+    refreshStats: scheduler.stats,
     init: (param: IApp) => {
       app = param
     },
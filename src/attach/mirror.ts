@@ -0,0 +1,118 @@
+import {Buffer, NeovimClient} from '@chemzqm/neovim'
+
+const logger = require('../util/logger')('attach/mirror') // tslint:disable-line
+
+/*
+ * Server-side copy of attached buffers, kept current by `nvim_buf_attach` line
+ * events so a refresh doesn't need to fetch the whole buffer again.
+ */
+
+interface LinesEvent {
+  changedtick: number
+  firstline: number
+  lastline: number
+  linedata: string[]
+}
+
+interface Mirror {
+  lines: string[] | null
+  changedtick: number
+  // events received while the lines are fetched
+  pending: LinesEvent[]
+}
+
+const mirrors: {[bufnr: number]: Mirror} = {}
+
+// Buffers which can't be attached to (e.g. vim without nvim_buf_attach)
+const unsupported = new Set<number>()
+// Buffers with registered event listeners, which outlive a detach
+const listening = new Set<number>()
+
+function onLines(
+  bufnr: number,
+  changedtick: number,
+  firstline: number,
+  lastline: number,
+  linedata: string[]
+) {
+  const mirror = mirrors[bufnr]
+  if (!mirror) {
+    return
+  }
+  // changedtick is null when the change didn't increment it
+  if (!mirror.lines) {
+    // the fetched lines may or may not include it, their changedtick tells
+    const last = mirror.pending[mirror.pending.length - 1]
+    mirror.pending.push({changedtick: changedtick ?? (last ? last.changedtick : -1), firstline, lastline, linedata})
+    return
+  }
+  applyLines(mirror, {changedtick: changedtick ?? mirror.changedtick, firstline, lastline, linedata})
+}
+
+function applyLines(mirror: Mirror, {changedtick, firstline, lastline, linedata}: LinesEvent) {
+  if (lastline === -1) {
+    lastline = mirror.lines.length
+  }
+  mirror.lines.splice(firstline, lastline - firstline, ...linedata)
+  mirror.changedtick = changedtick
+}
+
+async function attachBuffer(nvim: NeovimClient, buffer: Buffer) {
+  const bufnr = buffer.id
+  const mirror: Mirror = {lines: null, changedtick: 0, pending: []}
+  mirrors[bufnr] = mirror
+
+  if (!listening.has(bufnr)) {
+    listening.add(bufnr)
+    buffer.listen('lines', (_buffer, changedtick, firstline, lastline, linedata) => {
+      onLines(bufnr, changedtick, firstline, lastline, linedata)
+    })
+    buffer.listen('detach', () => {
+      delete mirrors[bufnr]
+    })
+  }
+
+  const attached = await buffer.attach(false)
+  if (!attached) {
+    throw new Error(`could not attach to buffer ${bufnr}`)
+  }
+
+  // lines and changedtick of the same state, events received meanwhile
+  // apply only if they are newer
+  const [results, error] = await nvim.callAtomic([
+    ['nvim_buf_get_lines', [bufnr, 0, -1, false]],
+    ['nvim_buf_get_changedtick', [bufnr]],
+  ])
+  if (error) {
+    throw new Error(`call_atomic failed: ${JSON.stringify(error)}`)
+  }
+  const [lines, changedtick] = results as [string[], number]
+  mirror.lines = lines
+  mirror.changedtick = changedtick
+  mirror.pending.filter((event) => event.changedtick > changedtick).forEach((event) => applyLines(mirror, event))
+  mirror.pending = []
+}
+
+/**
+ * Lines of `buffer`, served from the mirror once the buffer is attached
+ */
+export async function getBufferLines(nvim: NeovimClient, buffer: Buffer): Promise<string[]> {
+  const bufnr = buffer.id
+  if (unsupported.has(bufnr)) {
+    return buffer.getLines()
+  }
+
+  if (!mirrors[bufnr]) {
+    try {
+      await attachBuffer(nvim, buffer)
+    } catch (e) {
+      logger.error('attach buffer: ', bufnr, e)
+      delete mirrors[bufnr]
+      unsupported.add(bufnr)
+      return buffer.getLines()
+    }
+  }
+
+  const mirror = mirrors[bufnr]
+  return mirror && mirror.lines ? mirror.lines.slice() : buffer.getLines()
+}
@@ -0,0 +1,136 @@
+import {NeovimClient} from '@chemzqm/neovim'
+import {getRefreshState, RefreshState} from './state'
+import {counter, histogram, time} from '../util/metrics'
+
+const logger = require('../util/logger')('attach/scheduler') // tslint:disable-line
+
+/*
+ * Serializes refresh notifications from vim.
+ *
+ * Only one refresh runs at a time and notifications arriving meanwhile are
+ * coalesced into a single follow-up run, so results can't arrive out of
+ * order. A refresh superseded before its state was fetched is dropped.
+ * Cursor moves that didn't change the buffer only send scroll fields, and
+ * content refreshes are spaced by at least `g:zortex_refresh_interval` ms.
+ */
+
+export interface RefreshHandlers {
+  // render the buffer and send it to the preview
+  content: (state: RefreshState) => Promise<void>
+  // send only the cursor and window fields
+  scroll: (state: RefreshState) => void
+}
+
+export interface SchedulerStats {
+  requested: number
+  coalesced: number
+  dropped: number
+  content: number
+  scroll: number
+  errors: number
+}
+
+// seconds taken by each stage of a refresh: gather (rpc), index, populate,
+// serialize and emit
+export const REFRESH_STAGE = 'zortex_refresh_stage_seconds'
+histogram(REFRESH_STAGE, 'Seconds taken by each stage of a preview refresh')
+
+export function createScheduler(nvim: NeovimClient, handlers: RefreshHandlers) {
+  const stats: SchedulerStats = {
+    requested: 0,
+    coalesced: 0,
+    dropped: 0,
+    content: 0,
+    scroll: 0,
+    errors: 0,
+  }
+  counter('zortex_refresh_total', 'Refresh notifications by outcome', () =>
+    Object.keys(stats).map((outcome) => ({labels: {outcome}, value: stats[outcome]}))
+  )
+
+  let generation = 0
+  let running = false
+  let queued = false
+  let timer: NodeJS.Timeout = null
+  // buffer name and changedtick of the last content refresh
+  let lastContentKey: string = null
+  let lastContentAt = 0
+
+  async function refresh(gen: number) {
+    const state = await time(REFRESH_STAGE, {stage: 'gather', source: 'notify'}, () => getRefreshState(nvim))
+    if (gen !== generation) {
+      stats.dropped++
+      return
+    }
+
+    const key = `${state.name}:${state.changedtick}`
+    if (key === lastContentKey) {
+      stats.scroll++
+      handlers.scroll(state)
+      return
+    }
+
+    const wait = lastContentAt + (state.config.refreshInterval || 0) - Date.now()
+    if (wait > 0) {
+      timer = setTimeout(() => {
+        timer = null
+        run()
+      }, wait)
+      return
+    }
+
+    lastContentAt = Date.now()
+    lastContentKey = key
+    stats.content++
+    try {
+      await handlers.content(state)
+    } catch (e) {
+      lastContentKey = null
+      throw e
+    }
+  }
+
+  async function run() {
+    running = true
+    queued = false
+    try {
+      await refresh(generation)
+    } catch (e) {
+      stats.errors++
+      logger.error('refresh: ', e)
+    } finally {
+      running = false
+    }
+
+    if (queued && !timer) {
+      run()
+    }
+  }
+
+  return {
+    stats,
+
+    /**
+     * Schedule a refresh for the current buffer
+     */
+    request() {
+      stats.requested++
+      generation++
+      if (running || timer) {
+        if (queued) {
+          stats.coalesced++
+        }
+        queued = true
+        return
+      }
+      run()
+    },
+
+    /**
+     * Force the next refresh to render the content, e.g. after a config change
+     */
+    invalidate() {
+      lastContentKey = null
+    },
+  }
+}
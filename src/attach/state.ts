@@ -0,0 +1,120 @@
+import {Buffer, NeovimClient} from '@chemzqm/neovim'
+
+/*
+ * Gather everything a refresh needs from vim in a single `nvim_call_atomic`.
+ *
+ * Config variables are cached until vim reports a change to `g:zortex_*`
+ * (see `zortex#rpc#watch_config`). When vim can't watch `g:` the config is
+ * fetched with every refresh, still in the same batch.
+ */
+
+export interface Config {
+  notesDir: string
+  extension: string
+  previewOptions: any
+  pageTitle: string
+  theme: string
+  markdownCss: string
+  highlightCss: string
+  refreshInterval: number
+  serverRender: boolean
+}
+
+export interface RefreshState {
+  config: Config
+  buffer: Buffer
+  name: string
+  winline: number
+  winheight: number
+  cursor: number[]
+  changedtick: number
+}
+
+const configVars: {[key in keyof Config]: string} = {
+  notesDir: 'zortex_notes_dir',
+  extension: 'zortex_extension',
+  previewOptions: 'zortex_preview_options',
+  pageTitle: 'zortex_page_title',
+  theme: 'zortex_theme',
+  markdownCss: 'zortex_markdown_css',
+  highlightCss: 'zortex_highlight_css',
+  refreshInterval: 'zortex_refresh_interval',
+  serverRender: 'zortex_server_render',
+}
+const configKeys = Object.keys(configVars)
+
+// Single expression evaluating to the list of config values
+const configExpr = `[${configKeys.map((key) => `get(g:, '${configVars[key]}', v:null)`).join(', ')}]`
+
+let cachedConfig: Config = null
+let isWatched = false
+
+function toConfig(values: any[]): Config {
+  return configKeys.reduce((acc, key, i) => {
+    acc[key] = values[i]
+    return acc
+  }, {} as Config)
+}
+
+async function callAtomic(nvim: NeovimClient, calls: [string, any[]][]): Promise<any[]> {
+  const [results, error] = await nvim.callAtomic(calls)
+  if (error) {
+    throw new Error(`call_atomic failed: ${JSON.stringify(error)}`)
+  }
+  return results
+}
+
+/**
+ * Ask vim to notify `config_changed` when `g:zortex_*` changes, enabling the config cache
+ */
+export async function watchConfig(nvim: NeovimClient, channelId: number) {
+  isWatched = !!(await nvim.call('zortex#rpc#watch_config', [channelId]))
+}
+
+export function invalidateConfig() {
+  cachedConfig = null
+}
+
+export async function getConfig(nvim: NeovimClient): Promise<Config> {
+  if (cachedConfig) {
+    return cachedConfig
+  }
+  const config = toConfig(await nvim.eval(configExpr) as any[])
+  if (isWatched) {
+    cachedConfig = config
+  }
+  return config
+}
+
+export async function getRefreshState(nvim: NeovimClient): Promise<RefreshState> {
+  const calls: [string, any[]][] = [
+    ['nvim_call_function', ['bufnr', ['%']]],
+    ['nvim_call_function', ['expand', ['%:p']]],
+    ['nvim_call_function', ['winline', []]],
+    ['nvim_call_function', ['winheight', [0]]],
+    ['nvim_call_function', ['getpos', ['.']]],
+    ['nvim_call_function', ['getbufvar', ['%', 'changedtick']]],
+  ]
+  if (!cachedConfig) {
+    calls.push(['nvim_eval', [configExpr]])
+  }
+
+  const [bufnr, name, winline, winheight, cursor, changedtick, configValues] = await callAtomic(nvim, calls)
+  let config = cachedConfig
+  if (!config) {
+    config = toConfig(configValues)
+    if (isWatched) {
+      cachedConfig = config
+    }
+  }
+
+  return {
+    config,
+    buffer: nvim.createBuffer(bufnr),
+    name,
+    winline,
+    winheight,
+    cursor,
+    changedtick,
+  }
+}
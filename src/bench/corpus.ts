@@ -0,0 +1,177 @@
+import * as fs from 'fs'
+import * as path from 'path'
+
+/*
+ * Synthetic notes directory for benchmarks. The same options and seed always
+ * write the same files, so results of different releases are comparable.
+ *
+ * Tags are drawn from a Zipf distribution: a few tags are on most zettels and
+ * most tags are rare, like in real notes. A fraction of the articles are hubs
+ * made of `% #tag#` queries, the others are prose with lists and links.
+ */
+
+export interface CorpusOptions {
+  articles: number
+  zettels: number
+  tags: number
+  // exponent of the Zipf distribution of tags, 0 draws tags uniformly
+  skew: number
+  // tags per zettel
+  zettelTags: number
+  // lines of zettels spanning several lines
+  zettelLines: number
+  // fraction of articles which are hubs
+  hubs: number
+  // queries per hub
+  hubQueries: number
+  // root structures, and depth and children per node of their trees
+  structures: number
+  structureDepth: number
+  structureFanout: number
+  seed: number
+}
+
+export interface Corpus {
+  notesDir: string
+  extension: string
+  zettelsFile: string
+  titles: string[]
+  tags: string[]
+  // file names of the hub articles
+  hubs: string[]
+}
+
+export const defaultCorpusOptions: CorpusOptions = {
+  articles: 2000,
+  zettels: 20000,
+  tags: 500,
+  skew: 1.1,
+  zettelTags: 3,
+  zettelLines: 3,
+  hubs: 0.05,
+  hubQueries: 20,
+  structures: 20,
+  structureDepth: 5,
+  structureFanout: 4,
+  seed: 1,
+}
+
+const EXTENSION = '.zortex'
+
+const words = (
+  'note idea graph index query tag link article zettel outline project task review draft topic system ' +
+  'memory theory method result source reading paper model design pattern daily weekly archive context ' +
+  'question answer insight summary detail example reference concept principle habit goal plan'
+).split(' ')
+
+// mulberry32, a small seeded generator
+export function createRandom(seed: number) {
+  let state = seed >>> 0
+  return () => {
+    state = (state + 0x6d2b79f5) >>> 0
+    let t = state
+    t = Math.imul(t ^ (t >>> 15), t | 1)
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61)
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296
+  }
+}
+
+// draw indexes 0..n-1 with probability proportional to 1 / (i + 1) ^ skew
+function createZipf(random: () => number, n: number, skew: number) {
+  const cdf = new Float64Array(n)
+  let total = 0
+  for (let i = 0; i < n; i++) {
+    total += 1 / Math.pow(i + 1, skew)
+    cdf[i] = total
+  }
+  return () => {
+    const x = random() * total
+    let lo = 0
+    let hi = n - 1
+    while (lo < hi) {
+      const mid = (lo + hi) >> 1
+      if (cdf[mid] < x) {
+        lo = mid + 1
+      } else {
+        hi = mid
+      }
+    }
+    return lo
+  }
+}
+
+export function createCorpus(notesDir: string, options: CorpusOptions): Corpus {
+  const random = createRandom(options.seed)
+  const pick = <T>(items: T[]) => items[Math.floor(random() * items.length)]
+  const sentence = (length: number) => Array.from({length}, () => pick(words)).join(' ')
+  const tags = Array.from({length: options.tags}, (_, i) => `${pick(words)}-${i}`)
+  const drawTag = createZipf(random, tags.length, options.skew)
+  const drawTags = (count: number) => {
+    const drawn = new Set<string>()
+    for (let i = 0; i < count * 4 && drawn.size < count; i++) {
+      drawn.add(tags[drawTag()])
+    }
+    return [...drawn]
+  }
+
+  fs.rmSync(notesDir, {recursive: true, force: true})
+  fs.mkdirSync(notesDir, {recursive: true})
+
+  // zettels
+  const zettelLines: string[] = []
+  for (let i = 0; i < options.zettels; i++) {
+    const id = `z:${String(i).padStart(7, '0')}.${options.seed}`
+    zettelLines.push(`[${id}] #${drawTags(options.zettelTags).join('#')}# ${sentence(8 + Math.floor(random() * 12))}`)
+    if (random() < 0.1) {
+      for (let j = 1; j < options.zettelLines; j++) {
+        zettelLines.push(`    ${sentence(10)}`)
+      }
+    }
+  }
+  const zettelsFile = path.join(notesDir, 'zettels' + EXTENSION)
+  fs.writeFileSync(zettelsFile, zettelLines.join('\n') + '\n')
+
+  // articles, named like notes created by the plugin
+  const titles = Array.from({length: options.articles}, (_, i) => `${sentence(1 + (i % 3))} ${i}`.replace(/^./, (c) => c.toUpperCase()))
+  const hubs: string[] = []
+  titles.forEach((title, i) => {
+    const fileName = `${String(2022010000000 + i)}${EXTENSION}`
+    const lines = [`@@${title}`, ...drawTags(2).map((tag) => `@${tag}`), '']
+    if (random() < options.hubs) {
+      hubs.push(fileName)
+      for (let j = 0; j < options.hubQueries; j++) {
+        lines.push(`# ${sentence(2)}`, '', `% #${drawTags(1 + (j % 2)).join('#')}#`, '')
+      }
+    } else {
+      const sections = 2 + Math.floor(random() * 4)
+      for (let j = 0; j < sections; j++) {
+        lines.push(`# ${sentence(3)}`, '', sentence(40), '')
+        for (let k = 0; k < 4; k++) {
+          lines.push(`- ${sentence(6)} [${pick(titles)}](${pick(titles)})`)
+        }
+        lines.push('', '. ' + sentence(8), '10:30 ' + sentence(4), '')
+      }
+    }
+    fs.writeFileSync(path.join(notesDir, fileName), lines.join('\n'))
+  })
+
+  // structures, deep trees of links to articles
+  const structureLines: string[] = []
+  const branch = (depth: number, indent: number) => {
+    if (depth === 0) {
+      return
+    }
+    for (let i = 0; i < options.structureFanout; i++) {
+      structureLines.push(`${' '.repeat(indent)}- [${pick(titles)}]`)
+      branch(depth - 1, indent + 4)
+    }
+  }
+  for (let i = 0; i < options.structures; i++) {
+    structureLines.push(`* [${pick(titles)}] #${drawTags(1).join('#')}#`)
+    branch(options.structureDepth, 4)
+    structureLines.push('')
+  }
+  fs.writeFileSync(path.join(notesDir, 'structure' + EXTENSION), structureLines.join('\n'))
+
+  return {notesDir, extension: EXTENSION, zettelsFile, titles, tags, hubs}
+}
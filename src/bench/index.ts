@@ -0,0 +1,307 @@
+import * as fs from 'fs'
+import * as os from 'os'
+import * as path from 'path'
+import * as url from 'url'
+import {Zettels} from '../zortex/types'
+import {indexZettels, populateHub} from '../zortex/zettel'
+import {fetchQuery, parseQuery} from '../zortex/query'
+import {getArticles, searchArticles} from '../zortex/wiki'
+import {getArticleStructures, getMatchingStructures, parseStructures} from '../zortex/structures'
+import {Corpus, CorpusOptions, createCorpus, createRandom, defaultCorpusOptions} from './corpus'
+
+/*
+ * Benchmarks of indexing, queries, hubs, articles, structures and markdown
+ * rendering on a generated corpus.
+ *
+ *   yarn bench [--zettels 20000 --articles 2000 ...] [--out results.json]
+ *              [--compare previous.json --threshold 1.25]
+ *
+ * Each stage reports latency percentiles per sample, throughput in items
+ * per second and the peak heap growth sampled while it ran. Results are
+ * saved as JSON; with --compare, stages whose p50 grew by more than the
+ * threshold are reported and the run exits with status 1.
+ */
+
+interface BenchOptions {
+  iterations: number
+  dir: string
+  out: string
+  compare: string | null
+  threshold: number
+}
+
+export interface StageResult {
+  name: string
+  unit: string
+  samples: number
+  items: number
+  totalMs: number
+  meanMs: number
+  p50Ms: number
+  p99Ms: number
+  // items per second
+  throughput: number
+  peakHeapBytes: number
+}
+
+export interface BenchResults {
+  version: string
+  node: string
+  platform: string
+  date: string
+  corpus: CorpusOptions
+  stages: StageResult[]
+}
+
+const HEAP_INTERVAL = 2
+
+function parseArgs(args: string[]) {
+  const corpus: CorpusOptions = {...defaultCorpusOptions}
+  const bench: BenchOptions = {
+    iterations: 10,
+    dir: path.join(os.tmpdir(), 'zortex-bench'),
+    out: path.join(os.tmpdir(), 'zortex-bench-results', `${new Date().toISOString().replace(/[:.]/g, '-')}.json`),
+    compare: null,
+    threshold: 1.25,
+  }
+  for (let i = 0; i < args.length; i += 2) {
+    const key = args[i].replace(/^--/, '')
+    const value = args[i + 1]
+    if (value === undefined) {
+      throw new Error(`missing value for ${args[i]}`)
+    }
+    if (key in corpus) {
+      corpus[key] = Number(value)
+    } else if (key === 'iterations' || key === 'threshold') {
+      bench[key] = Number(value)
+    } else if (key === 'dir' || key === 'out' || key === 'compare') {
+      bench[key] = value
+    } else {
+      throw new Error(`unknown option ${args[i]}`)
+    }
+  }
+  return {corpus, bench}
+}
+
+function percentile(sorted: number[], q: number) {
+  return sorted.length === 0 ? 0 : sorted[Math.min(sorted.length - 1, Math.max(0, Math.ceil(q * sorted.length) - 1))]
+}
+
+/**
+ * Run `fn` for each sample, `fn` resolves to the number of items it handled
+ */
+async function measure(
+  name: string,
+  unit: string,
+  samples: number,
+  fn: (i: number) => number | Promise<number>
+): Promise<StageResult> {
+  // with node --expose-gc, start from a collected heap
+  const gc = (global as any).gc
+  if (gc) {
+    gc()
+  }
+  const baseline = process.memoryUsage().heapUsed
+  let peak = baseline
+  const sampleHeap = () => {
+    peak = Math.max(peak, process.memoryUsage().heapUsed)
+  }
+  const timer = setInterval(sampleHeap, HEAP_INTERVAL)
+
+  const times: number[] = []
+  let items = 0
+  try {
+    for (let i = 0; i < samples; i++) {
+      const start = process.hrtime.bigint()
+      items += await fn(i)
+      times.push(Number(process.hrtime.bigint() - start) / 1e6)
+      sampleHeap()
+    }
+  } finally {
+    clearInterval(timer)
+  }
+
+  const totalMs = times.reduce((a, b) => a + b, 0)
+  const sorted = [...times].sort((a, b) => a - b)
+  return {
+    name,
+    unit,
+    samples,
+    items,
+    totalMs,
+    meanMs: totalMs / Math.max(samples, 1),
+    p50Ms: percentile(sorted, 0.5),
+    p99Ms: percentile(sorted, 0.99),
+    throughput: totalMs > 0 ? (items * 1000) / totalMs : 0,
+    peakHeapBytes: peak - baseline,
+  }
+}
+
+// the markdown-it plugin is an ES module of the app, it is loaded from a copy
+// importing markdown-it by path since node doesn't resolve extensionless imports
+async function loadZettelkasten() {
+  const source = path.join(__dirname, '../../components/markdown/zortex.js')
+  const utils = url.pathToFileURL(require.resolve('markdown-it/lib/common/utils')).href
+  const copy = path.join(os.tmpdir(), `zortex-bench-${process.pid}.mjs`)
+  fs.writeFileSync(
+    copy,
+    fs.readFileSync(source, 'utf8').replace(/from 'markdown-it\/lib\/common\/utils'/, `from ${JSON.stringify(utils)}`)
+  )
+  // tsc compiles import() to require() for commonjs
+  const importModule = new Function('specifier', 'return import(specifier)')
+  try {
+    return (await importModule(url.pathToFileURL(copy).href)).default
+  } finally {
+    fs.rmSync(copy, {force: true})
+  }
+}
+
+async function runStages(corpus: Corpus, options: CorpusOptions, iterations: number) {
+  const stages: StageResult[] = []
+  const random = createRandom(options.seed + 1)
+  const pick = <T>(items: T[]) => items[Math.floor(random() * items.length)]
+  const run = async (...args: Parameters<typeof measure>) => {
+    const result = await measure(...args)
+    stages.push(result)
+    console.error(
+      `${result.name.padEnd(28)} p50 ${result.p50Ms.toFixed(2).padStart(9)}ms  p99 ${result.p99Ms
+        .toFixed(2)
+        .padStart(9)}ms  ${result.throughput.toFixed(0).padStart(10)} ${result.unit}/s  heap +${(
+        result.peakHeapBytes /
+        1024 /
+        1024
+      ).toFixed(1)}MB`
+    )
+  }
+
+  let zettels: Zettels = null
+  await run('indexZettels', 'zettels', iterations, async () => {
+    zettels = await indexZettels(corpus.zettelsFile)
+    return Object.keys(zettels.ids).length
+  })
+
+  const queries = Array.from({length: 500}, (_, i) =>
+    parseQuery(`% #${Array.from({length: 1 + (i % 3)}, () => pick(corpus.tags)).join('#')}#`)
+  )
+  // builds the posting lists
+  fetchQuery(queries[0], zettels)
+  await run('fetchQuery', 'queries', queries.length, (i) => {
+    fetchQuery(queries[i], zettels)
+    return 1
+  })
+
+  const hubs = corpus.hubs.map((fileName) => fs.readFileSync(path.join(corpus.notesDir, fileName), 'utf8').split('\n'))
+  const populated: string[][] = []
+  await run('populateHub', 'lines', hubs.length, async (i) => {
+    populated[i] = await populateHub(hubs[i], zettels, corpus.notesDir)
+    return populated[i].length
+  })
+
+  let articles = null
+  await run('getArticles (cold)', 'articles', 1, async () => {
+    articles = await getArticles(corpus.notesDir)
+    return Object.keys(articles).length
+  })
+
+  const terms = Array.from({length: 200}, () => pick(pick(corpus.titles).split(' ')))
+  await run('searchArticles', 'searches', terms.length, (i) => {
+    searchArticles(articles, terms[i])
+    return 1
+  })
+
+  const structureLines = fs.readFileSync(path.join(corpus.notesDir, 'structure' + corpus.extension), 'utf8').split('\n')
+  await run('getArticleStructures (cold)', 'structures', 1, async () => {
+    return Object.keys(await getArticleStructures(corpus.notesDir, corpus.extension)).length
+  })
+  let index = parseStructures(structureLines)
+  await run('parseStructures', 'lines', iterations, () => {
+    index = parseStructures(structureLines)
+    return structureLines.length
+  })
+  const names = Array.from({length: 1000}, () => pick(corpus.titles))
+  await run('getMatchingStructures', 'lookups', names.length, (i) => {
+    getMatchingStructures(names[i], index)
+    return 1
+  })
+
+  let zettelkasten = null
+  try {
+    zettelkasten = await loadZettelkasten()
+  } catch (e) {
+    console.error(`markdown: skipped, ${e.message}`)
+  }
+  if (zettelkasten) {
+    const MarkdownIt = require('markdown-it') // tslint:disable-line
+    const md = new MarkdownIt({html: true}).use(zettelkasten)
+    const documents = [
+      ...populated.map((lines) => lines.join('\n')),
+      ...corpus.titles
+        .slice(0, 200)
+        .map((_, i) => fs.readFileSync(path.join(corpus.notesDir, `${2022010000000 + i}${corpus.extension}`), 'utf8')),
+    ]
+    await run('markdown zettelkasten', 'documents', documents.length, (i) => {
+      md.render(documents[i])
+      return 1
+    })
+  }
+
+  return stages
+}
+
+function compareResults(previous: BenchResults, current: BenchResults, threshold: number) {
+  const before = new Map(previous.stages.map((stage) => [stage.name, stage]))
+  let regressions = 0
+  console.error(`\ncompared to ${previous.version} (${previous.date}):`)
+  for (const stage of current.stages) {
+    const old = before.get(stage.name)
+    if (!old || old.p50Ms === 0) {
+      continue
+    }
+    const ratio = stage.p50Ms / old.p50Ms
+    const regressed = ratio > threshold
+    regressions += regressed ? 1 : 0
+    console.error(
+      `${regressed ? '!' : ' '} ${stage.name.padEnd(28)} p50 ${old.p50Ms.toFixed(2)}ms -> ${stage.p50Ms.toFixed(2)}ms (${(
+        (ratio - 1) *
+        100
+      ).toFixed(1)}%)`
+    )
+  }
+  return regressions
+}
+
+export async function run(args: string[]) {
+  const {corpus: corpusOptions, bench} = parseArgs(args)
+  const {version} = require('../../../package.json') // tslint:disable-line
+
+  console.error(`generating corpus in ${bench.dir}`)
+  const corpus = createCorpus(bench.dir, corpusOptions)
+
+  const results: BenchResults = {
+    version,
+    node: process.version,
+    platform: `${process.platform}-${process.arch} ${os.cpus()[0]?.model || ''}`.trim(),
+    date: new Date().toISOString(),
+    corpus: corpusOptions,
+    stages: await runStages(corpus, corpusOptions, bench.iterations),
+  }
+  fs.mkdirSync(path.dirname(bench.out), {recursive: true})
+  fs.writeFileSync(bench.out, JSON.stringify(results, null, 2) + '\n')
+  console.error(`results saved to ${bench.out}`)
+
+  if (bench.compare) {
+    const previous: BenchResults = JSON.parse(fs.readFileSync(bench.compare, 'utf8'))
+    if (compareResults(previous, results, bench.threshold) > 0) {
+      process.exitCode = 1
+    }
+  }
+}
+
+if (require.main === module) {
+  run(process.argv.slice(2))
+    .then(() => process.exit())
+    .catch((e) => {
+      console.error(e)
+      process.exit(1)
+    })
+}
@@ -0,0 +1,313 @@
+import * as crypto from 'crypto'
+import * as fs from 'fs'
+import * as path from 'path'
+import * as util from 'util'
+import * as zlib from 'zlib'
+import {IncomingMessage, ServerResponse} from 'http'
+
+const logger = require('../util/logger')('server/assets') // tslint:disable-line
+
+/*
+ * Files served by the static routes, kept in memory with their gzip and
+ * brotli encodings and a strong ETag, so that a preview reload only
+ * revalidates them.
+ *
+ * Entries are checked against the file mtime and size on each request,
+ * except immutable ones (the hashed `_next/static` chunks). Files too large
+ * to keep are streamed with an ETag made of their mtime and size.
+ */
+
+export interface ServeOptions {
+  // content never changes for this path, let clients cache it for good
+  immutable?: boolean
+  statusCode?: number
+}
+
+interface Asset {
+  mtimeMs: number
+  size: number
+  type: string
+  etag: string
+  body: Buffer
+  gzip: Buffer | null
+  br: Buffer | null
+}
+
+const gzip = util.promisify(zlib.gzip)
+const brotli = util.promisify(zlib.brotliCompress)
+
+// larger files are streamed
+const MAX_ASSET_SIZE = 8 * 1024 * 1024
+// smaller files aren't worth compressing
+const MIN_COMPRESS_SIZE = 1024
+// memory kept for all assets, least recently served ones are dropped first
+const MAX_CACHE_SIZE = 256 * 1024 * 1024
+// files encoded at the same time when preloading, leaving libuv's thread
+// pool to the file reads of startup
+const CONCURRENCY = 2
+// brotli quality of files encoded on request, which wait for it; preloaded
+// files are encoded at the maximum quality
+const REQUEST_QUALITY = 5
+
+const IMMUTABLE = 'public, max-age=31536000, immutable'
+const REVALIDATE = 'no-cache'
+
+const types: {[extension: string]: string} = {
+  '.html': 'text/html; charset=utf-8',
+  '.js': 'application/javascript; charset=utf-8',
+  '.mjs': 'application/javascript; charset=utf-8',
+  '.css': 'text/css; charset=utf-8',
+  '.json': 'application/json; charset=utf-8',
+  '.map': 'application/json; charset=utf-8',
+  '.txt': 'text/plain; charset=utf-8',
+  '.md': 'text/markdown; charset=utf-8',
+  '.xml': 'application/xml',
+  '.svg': 'image/svg+xml',
+  '.png': 'image/png',
+  '.jpg': 'image/jpeg',
+  '.jpeg': 'image/jpeg',
+  '.gif': 'image/gif',
+  '.webp': 'image/webp',
+  '.avif': 'image/avif',
+  '.bmp': 'image/bmp',
+  '.tif': 'image/tiff',
+  '.tiff': 'image/tiff',
+  '.ico': 'image/x-icon',
+  '.woff': 'font/woff',
+  '.woff2': 'font/woff2',
+  '.ttf': 'font/ttf',
+  '.otf': 'font/otf',
+  '.eot': 'application/vnd.ms-fontobject',
+  '.wasm': 'application/wasm',
+  '.pdf': 'application/pdf',
+  '.mp4': 'video/mp4',
+  '.webm': 'video/webm',
+}
+
+const compressibleRE = /^(text\/|application\/(javascript|json|xml)|image\/svg)/
+
+// resolved file path -> asset, in least recently served order
+const assets = new Map<string, Asset>()
+let cacheSize = 0
+// loads in progress, shared by concurrent requests
+const loads = new Map<string, Promise<Asset>>()
+
+export function mimeType(filepath: string) {
+  return types[path.extname(filepath).toLowerCase()] || 'application/octet-stream'
+}
+
+async function encode(body: Buffer, type: string, quality: number) {
+  if (body.length < MIN_COMPRESS_SIZE || !compressibleRE.test(type)) {
+    return {gzip: null, br: null}
+  }
+  const [gzipped, brotlied] = await Promise.all([
+    gzip(body, {level: zlib.constants.Z_BEST_COMPRESSION}),
+    brotli(body, {params: {[zlib.constants.BROTLI_PARAM_QUALITY]: quality}}),
+  ])
+  // keep encodings which actually save bytes
+  return {
+    gzip: gzipped.length < body.length ? gzipped : null,
+    br: brotlied.length < body.length ? brotlied : null,
+  }
+}
+
+async function load(filepath: string, stat: fs.Stats, quality: number): Promise<Asset> {
+  const body = await fs.promises.readFile(filepath)
+  const type = mimeType(filepath)
+  const etag = `"${crypto.createHash('sha1').update(body).digest('base64').slice(0, 27)}"`
+  return {mtimeMs: stat.mtimeMs, size: stat.size, type, etag, body, ...(await encode(body, type, quality))}
+}
+
+const assetSize = (asset: Asset) => asset.body.length + (asset.gzip?.length || 0) + (asset.br?.length || 0)
+
+function setAsset(filepath: string, asset: Asset) {
+  deleteAsset(filepath)
+  assets.set(filepath, asset)
+  cacheSize += assetSize(asset)
+  for (const oldest of assets.keys()) {
+    if (cacheSize <= MAX_CACHE_SIZE || oldest === filepath) {
+      break
+    }
+    deleteAsset(oldest)
+  }
+}
+
+function deleteAsset(filepath: string) {
+  const asset = assets.get(filepath)
+  if (asset) {
+    assets.delete(filepath)
+    cacheSize -= assetSize(asset)
+  }
+}
+
+async function getAsset(filepath: string, stat: fs.Stats, quality = REQUEST_QUALITY) {
+  const cached = assets.get(filepath)
+  if (cached && cached.mtimeMs === stat.mtimeMs && cached.size === stat.size) {
+    assets.delete(filepath)
+    assets.set(filepath, cached)
+    return cached
+  }
+  let loading = loads.get(filepath)
+  if (!loading) {
+    loading = load(filepath, stat, quality).finally(() => loads.delete(filepath))
+    loads.set(filepath, loading)
+  }
+  const asset = await loading
+  setAsset(filepath, asset)
+  return asset
+}
+
+async function statFile(filepath: string) {
+  try {
+    const stat = await fs.promises.stat(filepath)
+    return stat.isFile() ? stat : null
+  } catch (e) {
+    if (e.code !== 'ENOENT' && e.code !== 'ENOTDIR') {
+      logger.error('stat asset: ', filepath, e)
+    }
+    return null
+  }
+}
+
+// If-None-Match wins over If-Modified-Since when both are sent
+function isFresh(req: IncomingMessage, etag: string, mtimeMs: number) {
+  const header = req.headers['if-none-match']
+  if (header) {
+    return header === '*' || header.split(',').some((tag) => tag.trim().replace(/^W\//, '') === etag)
+  }
+  const since = Date.parse(req.headers['if-modified-since'] || '')
+  // HTTP dates have a resolution of a second
+  return !isNaN(since) && Math.floor(mtimeMs / 1000) * 1000 <= since
+}
+
+// encodings of an Accept-Encoding header, without those refused with q=0
+function acceptedEncodings(header: string) {
+  const encodings = new Set<string>()
+  header.split(',').forEach((part) => {
+    const [name, ...params] = part.split(';').map((field) => field.trim().toLowerCase())
+    const q = params.find((param) => param.startsWith('q='))
+    if (name && !(q && Number(q.slice(2)) === 0)) {
+      encodings.add(name)
+    }
+  })
+  return encodings
+}
+
+function chooseEncoding(req: IncomingMessage, asset: Asset): 'br' | 'gzip' | null {
+  const header = req.headers['accept-encoding']
+  if (typeof header !== 'string' || (!asset.br && !asset.gzip)) {
+    return null
+  }
+  const encodings = acceptedEncodings(header)
+  if (asset.br && encodings.has('br')) {
+    return 'br'
+  }
+  if (asset.gzip && (encodings.has('gzip') || encodings.has('*'))) {
+    return 'gzip'
+  }
+  return null
+}
+
+function streamFile(req: IncomingMessage, res: ServerResponse, filepath: string, stat: fs.Stats, options: ServeOptions) {
+  const etag = `W/"${stat.size.toString(16)}-${Math.floor(stat.mtimeMs).toString(16)}"`
+  res.setHeader('Content-Type', mimeType(filepath))
+  res.setHeader('Cache-Control', options.immutable ? IMMUTABLE : REVALIDATE)
+  res.setHeader('ETag', etag)
+  res.setHeader('Last-Modified', new Date(stat.mtimeMs).toUTCString())
+  if (!options.statusCode && isFresh(req, etag.slice(2), stat.mtimeMs)) {
+    res.statusCode = 304
+    return res.end()
+  }
+  res.statusCode = options.statusCode || 200
+  res.setHeader('Content-Length', stat.size)
+  if (req.method === 'HEAD') {
+    return res.end()
+  }
+  fs.createReadStream(filepath).pipe(res)
+}
+
+/**
+ * Answer `req` with the file at `filepath`, resolve to false without
+ * answering when there is no such file
+ */
+export async function serveFile(
+  req: IncomingMessage,
+  res: ServerResponse,
+  filepath: string,
+  options: ServeOptions = {}
+): Promise<boolean> {
+  const resolved = path.resolve(filepath)
+  let asset = options.immutable ? assets.get(resolved) : undefined
+  if (!asset) {
+    const stat = await statFile(resolved)
+    if (!stat) {
+      return false
+    }
+    if (stat.size > MAX_ASSET_SIZE) {
+      streamFile(req, res, resolved, stat, options)
+      return true
+    }
+    asset = await getAsset(resolved, stat)
+  }
+
+  res.setHeader('Content-Type', asset.type)
+  res.setHeader('Cache-Control', options.immutable ? IMMUTABLE : REVALIDATE)
+  res.setHeader('ETag', asset.etag)
+  res.setHeader('Last-Modified', new Date(asset.mtimeMs).toUTCString())
+  if (asset.gzip || asset.br) {
+    res.setHeader('Vary', 'Accept-Encoding')
+  }
+  // a 404 page isn't a cached representation of the path
+  if (!options.statusCode && isFresh(req, asset.etag, asset.mtimeMs)) {
+    res.statusCode = 304
+    res.end()
+    return true
+  }
+
+  const encoding = chooseEncoding(req, asset)
+  const body = encoding ? asset[encoding] : asset.body
+  res.statusCode = options.statusCode || 200
+  if (encoding) {
+    res.setHeader('Content-Encoding', encoding)
+  }
+  res.setHeader('Content-Length', body.length)
+  res.end(req.method === 'HEAD' ? undefined : body)
+  return true
+}
+
+async function listFiles(dir: string): Promise<string[]> {
+  let items: fs.Dirent[]
+  try {
+    items = await fs.promises.readdir(dir, {withFileTypes: true})
+  } catch (e) {
+    if (e.code !== 'ENOENT') {
+      logger.error('list assets: ', dir, e)
+    }
+    return []
+  }
+  const nested = await Promise.all(
+    items.map((item) => {
+      const filepath = path.join(dir, item.name)
+      return item.isDirectory() ? listFiles(filepath) : Promise.resolve(item.isFile() ? [filepath] : [])
+    })
+  )
+  return nested.flat()
+}
+
+/**
+ * Load and encode the files of `dirs` ahead of the first requests
+ */
+export async function preloadAssets(dirs: string[]) {
+  const files = (await Promise.all(dirs.map(listFiles))).flat()
+  let next = 0
+  const worker = async () => {
+    while (next < files.length) {
+      const filepath = path.resolve(files[next++])
+      const stat = await statFile(filepath)
+      if (stat && stat.size <= MAX_ASSET_SIZE) {
+        await getAsset(filepath, stat, zlib.constants.BROTLI_MAX_QUALITY).catch((e) => logger.error('load asset: ', filepath, e))
+      }
+    }
+  }
+  await Promise.all(Array.from({length: Math.min(CONCURRENCY, files.length)}, worker))
+}
@@ -1,65 +1,218 @@
-import * as fs from 'fs'
 import * as path from 'path'
-import {indexZettels, populateHub} from '../zortex/zettel'
+import {populateHub} from '../zortex/zettel'
+import {getZettels} from '../zortex/store'
 import {parseArticleTitle} from '../zortex/wiki'
 import {getArticleFilepath} from '../zortex/helpers'
-import {LocalRequest, Routes} from './server'
+import {getBufferLines} from '../attach/mirror'
+import {getConfig, getRefreshState} from '../attach/state'
+import {REFRESH_STAGE} from '../attach/scheduler'
+import {startTimer, time} from '../util/metrics'
+import {serveFile} from './assets'
+import {renderBlocks} from './render'
+import {LocalRequest, Routes, routeFor} from './server'
+
+const route = routeFor<LocalRequest>()
 
 const routes: Routes<LocalRequest> = [
   // /buffer
-  (req, res, next) => {
-    if (/^\/buffer$/.test(req.asPath)) {
-      return fs.createReadStream('./out/buffer.html').pipe(res)
+  route('/buffer', async (req, res, next) => {
+    if (!(await serveFile(req, res, './out/buffer.html'))) {
+      next()
     }
-    next()
-  },
+  }),
 ]
 
+// Fields which only affect scrolling the preview
+const scrollFields = ['isActive', 'winline', 'winheight', 'cursor']
+
+/*
+ * Last content sent to clients. Each change of the rendered lines bumps the
+ * version, and clients apply a patch only if it is based on their version.
+ */
+const snapshot = {
+  version: 0,
+  data: null as null | {name: string; content: string[]; serverRender?: boolean},
+}
+
+// keys of the blocks clients at the current version have, in server render mode
+let sentKeys = new Set<string>()
+
+function pick(data: object, fields: string[]) {
+  return fields.reduce((acc, field) => {
+    acc[field] = data[field]
+    return acc
+  }, {})
+}
+
+/**
+ * Smallest line range replacement which turns `prev` into `next`
+ */
+export function diffLines(prev: string[], next: string[]) {
+  const max = Math.min(prev.length, next.length)
+  let start = 0
+  while (start < max && prev[start] === next[start]) {
+    start++
+  }
+  let end = 0
+  while (end < max - start && prev[prev.length - 1 - end] === next[next.length - 1 - end]) {
+    end++
+  }
+
+  return {
+    start,
+    deleteCount: prev.length - end - start,
+    lines: next.slice(start, next.length - end),
+  }
+}
+
+function sameContent(prev: {name: string; content: string[]}, data: {name: string; content: string[]}) {
+  if (!prev || prev.name !== data.name || prev.content.length !== data.content.length) {
+    return false
+  }
+  const patch = diffLines(prev.content, data.content)
+  return patch.deleteCount === 0 && patch.lines.length === 0
+}
+
+/*
+ * In server render mode clients get rendered blocks instead of lines. A
+ * patch leaves out the html of the blocks clients at its base version have,
+ * a full refresh (null base version) carries all of it.
+ */
+function blocksRefresh(data, baseVersion: number | null) {
+  const {content, ...fields} = data
+  const blocks = renderBlocks(content, baseVersion === null ? undefined : sentKeys)
+  if (!blocks) {
+    return null
+  }
+  sentKeys = new Set(blocks.filter((block) => block.key !== null).map((block) => block.key))
+  return {
+    event: 'refresh_blocks',
+    payload: {...fields, lineCount: content.length, baseVersion, version: snapshot.version, blocks},
+  }
+}
+
+// full refresh of the current content
+function currentRefresh() {
+  const data = snapshot.data
+  return (
+    (data.serverRender && blocksRefresh(data, null)) || {
+      event: 'refresh_content',
+      payload: {...data, version: snapshot.version},
+    }
+  )
+}
+
+// the version only changes with the content, so refreshing one client, e.g.
+// a new one, doesn't make the others' patches fail
+function fullRefresh(data) {
+  if (!sameContent(snapshot.data, data)) {
+    snapshot.version++
+  }
+  snapshot.data = data
+  return currentRefresh()
+}
+
+/**
+ * Message to broadcast for new refresh data: the scroll fields when the
+ * rendered lines didn't change, a versioned line-range patch when they did,
+ * and the full content when another buffer is previewed. Patches and full
+ * refreshes are rendered blocks in server render mode.
+ */
+export function nextRefresh(data) {
+  const prev = snapshot.data
+  if (!prev || prev.name !== data.name) {
+    return fullRefresh(data)
+  }
+
+  const patch = diffLines(prev.content, data.content)
+  if (patch.deleteCount === 0 && patch.lines.length === 0) {
+    snapshot.data = data
+    return {event: 'refresh_scroll', payload: {...pick(data, scrollFields), version: snapshot.version}}
+  }
+
+  const {content, ...fields} = data
+  const baseVersion = snapshot.version
+  snapshot.version++
+  snapshot.data = data
+  return (
+    (data.serverRender && blocksRefresh(data, baseVersion)) || {
+      event: 'refresh_patch',
+      payload: {...fields, baseVersion, version: snapshot.version, patch},
+    }
+  )
+}
+
+/**
+ * Message to broadcast when only the scroll fields changed, null when the
+ * clients show another buffer and need a full refresh first
+ */
+export function scrollRefresh(data) {
+  if (!snapshot.data || snapshot.data.name !== data.name) {
+    return null
+  }
+  return {event: 'refresh_scroll', payload: {...pick(data, scrollFields), version: snapshot.version}}
+}
+
+/**
+ * Path of the file the preview shows, null before the first refresh
+ */
+export function previewedFile(): string | null {
+  return snapshot.data?.name || null
+}
+
 const getRefreshContent = async (plugin) => {
-  const notesDir = await plugin.nvim.getVar('zortex_notes_dir')
-  const extension = await plugin.nvim.getVar('zortex_extension')
-  const zettels = await indexZettels(path.join(notesDir, 'zettels' + extension))
-
-  const buffer = await plugin.nvim.buffer
-  const winline = await plugin.nvim.call('winline')
-  const currentWindow = await plugin.nvim.window
-  const winheight = await plugin.nvim.call('winheight', currentWindow.id)
-  const cursor = await plugin.nvim.call('getpos', '.')
-  const options = await plugin.nvim.getVar('zortex_preview_options')
-  const pageTitle = await plugin.nvim.getVar('zortex_page_title')
-  const theme = await plugin.nvim.getVar('zortex_theme')
-  const name = await buffer.name
-  const bufferLines = await buffer.getLines()
-  const content = await populateHub(bufferLines, zettels, notesDir)
+  const labels = {source: 'connect'}
+  const state = await time(REFRESH_STAGE, {stage: 'gather', ...labels}, () => getRefreshState(plugin.nvim))
+  const {notesDir, extension} = state.config
+  const [zettels, bufferLines] = await time(REFRESH_STAGE, {stage: 'index', ...labels}, () =>
+    Promise.all([getZettels(path.join(notesDir, 'zettels' + extension)), getBufferLines(plugin.nvim, state.buffer)])
+  )
+  const content = await time(REFRESH_STAGE, {stage: 'populate', ...labels}, () =>
+    populateHub(bufferLines, zettels, notesDir)
+  )
 
   const articleTitle = parseArticleTitle(bufferLines[0])
 
-
   return {
-    options,
+    serverRender: !!state.config.serverRender,
+    options: state.config.previewOptions,
     isActive: true,
-    winline,
-    winheight,
-    cursor,
-    pageTitle,
-    theme,
-    name,
+    winline: state.winline,
+    winheight: state.winheight,
+    cursor: state.cursor,
+    pageTitle: state.config.pageTitle,
+    theme: state.config.theme,
+    name: state.name,
     content,
-    zettels,
     articleTitle,
   }
 }
 
 export const onWebsocketConnection = async (logger, client, plugin) => {
-  client.emit('refresh_content', await getRefreshContent(plugin))
+  const data = await getRefreshContent(plugin)
+  const serialized = startTimer(REFRESH_STAGE, {stage: 'serialize', source: 'connect'})
+  const {event, payload} = fullRefresh(data)
+  serialized()
+  const emitted = startTimer(REFRESH_STAGE, {stage: 'emit', source: 'connect'})
+  client.emit(event, payload)
+  emitted()
+
+  // client missed a patch
+  client.on('request_content', () => {
+    if (snapshot.data) {
+      const refresh = currentRefresh()
+      client.emit(refresh.event, refresh.payload)
+    }
+  })
 
   client.on('change_page', async (articleName: string) => {
-    const notesDir = await plugin.nvim.getVar('zortex_notes_dir')
+    const {notesDir} = await getConfig(plugin.nvim)
     const filepath = await getArticleFilepath(notesDir, articleName)
     if (filepath) {
       plugin.nvim.command(`edit ${filepath}`)
         .then(async () => {
-          client.emit('refresh_content', await getRefreshContent(plugin))
+          const refresh = fullRefresh(await getRefreshContent(plugin))
+          client.emit(refresh.event, refresh.payload)
         })
     }
   })
@@ -0,0 +1,199 @@
+import * as child_process from 'child_process'
+import * as crypto from 'crypto'
+import * as fs from 'fs'
+import * as os from 'os'
+import * as path from 'path'
+import * as url from 'url'
+import {mimeType, serveFile} from './assets'
+import {previewedFile} from './buffer'
+import {LocalRequest, Routes, routeFor} from './server'
+
+/*
+ * Local images of the previewed note, /_local_image_<path>?bufnr&width.
+ *
+ * Image paths are relative to the directory of the note, or absolute paths
+ * found under one of its parent directories. Resolved paths are remembered,
+ * and so are misses for a while, so a note with many images doesn't search
+ * the file system for each of them on every load.
+ *
+ * Only files with an image type are served, wherever they are.
+ *
+ * With `width`, large images are downscaled by ImageMagick when it is
+ * installed, and the thumbnail is kept in the cache directory.
+ */
+
+interface Resolved {
+  filepath: string | null
+  time: number
+}
+
+// missing images are searched again after this time
+const MISS_TTL = 5000
+const MAX_RESOLVED = 4096
+// smaller images are served as they are
+const THUMBNAIL_MIN_SIZE = 256 * 1024
+const THUMBNAIL_MAX_WIDTH = 4096
+const thumbnailRE = /\.(png|jpe?g|gif|webp|bmp|tiff?)$/i
+
+// bufnr -> directory of its file
+const bufferDirs = new Map<number, string>()
+// `${dir}\0${image}` -> file path, in least recently resolved order
+const resolved = new Map<string, Resolved>()
+// thumbnails being made, by thumbnail path
+const thumbnails = new Map<string, Promise<boolean>>()
+let canResize = true
+
+const route = routeFor<LocalRequest>()
+
+async function isFile(filepath: string) {
+  try {
+    return (await fs.promises.stat(filepath)).isFile()
+  } catch (e) {
+    return false
+  }
+}
+
+async function bufferDir(req: LocalRequest, bufnr: number) {
+  if (!bufnr) {
+    const file = previewedFile()
+    return file ? path.dirname(file) : null
+  }
+  if (!bufferDirs.has(bufnr)) {
+    const dir: string = await req.plugin.nvim.call('expand', `#${bufnr}:p:h`)
+    if (!dir) {
+      return null
+    }
+    bufferDirs.set(bufnr, dir)
+  }
+  return bufferDirs.get(bufnr)
+}
+
+async function searchImage(fileDir: string, image: string) {
+  if (!mimeType(image).startsWith('image/')) {
+    return null
+  }
+  if (image[0] !== '/' && image[0] !== '\\') {
+    const filepath = path.join(fileDir, image)
+    return (await isFile(filepath)) ? filepath : null
+  }
+  if (await isFile(image)) {
+    return image
+  }
+  // absolute to one of the parents of the note
+  let dir = fileDir
+  while (dir !== '/' && dir !== '\\' && dir !== path.dirname(dir)) {
+    dir = path.dirname(dir)
+    const filepath = path.join(dir, image)
+    if (await isFile(filepath)) {
+      return filepath
+    }
+  }
+  return null
+}
+
+async function resolveImage(fileDir: string, image: string) {
+  const key = `${fileDir}\0${image}`
+  const cached = resolved.get(key)
+  if (cached && (cached.filepath !== null || Date.now() - cached.time < MISS_TTL)) {
+    return cached.filepath
+  }
+  const filepath = await searchImage(fileDir, image)
+  resolved.delete(key)
+  resolved.set(key, {filepath, time: Date.now()})
+  if (resolved.size > MAX_RESOLVED) {
+    resolved.delete(resolved.keys().next().value)
+  }
+  return filepath
+}
+
+function thumbnailPath(filepath: string, stat: fs.Stats, width: number) {
+  const cacheDir = process.env.XDG_CACHE_HOME || path.join(os.homedir(), '.cache')
+  const name = crypto
+    .createHash('sha1')
+    .update(`${filepath}\0${stat.mtimeMs}\0${stat.size}\0${width}`)
+    .digest('hex')
+    .slice(0, 16)
+  return path.join(cacheDir, 'zortex', 'thumbnails', name + path.extname(filepath).toLowerCase())
+}
+
+function resize(filepath: string, thumbnail: string, width: number) {
+  return new Promise<boolean>((resolve) => {
+    const tmpThumbnail = `${thumbnail}.${process.pid}${path.extname(thumbnail)}`
+    // `>` only shrinks images wider than `width`, the first frame of gifs
+    const convert = child_process.spawn('convert', [`${filepath}[0]`, '-thumbnail', `${width}x>`, tmpThumbnail])
+    convert.on('error', (e: NodeJS.ErrnoException) => {
+      if (e.code === 'ENOENT') {
+        canResize = false
+      }
+      resolve(false)
+    })
+    convert.on('close', (code) => {
+      if (code !== 0) {
+        fs.promises.rm(tmpThumbnail, {force: true}).finally(() => resolve(false))
+        return
+      }
+      fs.promises.rename(tmpThumbnail, thumbnail).then(() => resolve(true), () => resolve(false))
+    })
+  })
+}
+
+// thumbnail of the image at `filepath` at most `width` pixels wide, null when
+// the image is served as it is
+async function getThumbnail(filepath: string, width: number) {
+  if (!canResize || !thumbnailRE.test(filepath)) {
+    return null
+  }
+  const stat = await fs.promises.stat(filepath)
+  if (stat.size < THUMBNAIL_MIN_SIZE) {
+    return null
+  }
+  const thumbnail = thumbnailPath(filepath, stat, width)
+  if (await isFile(thumbnail)) {
+    return thumbnail
+  }
+  let making = thumbnails.get(thumbnail)
+  if (!making) {
+    making = fs.promises
+      .mkdir(path.dirname(thumbnail), {recursive: true})
+      .then(() => resize(filepath, thumbnail, width))
+      .finally(() => thumbnails.delete(thumbnail))
+    thumbnails.set(thumbnail, making)
+  }
+  return (await making) ? thumbnail : null
+}
+
+const routes: Routes<LocalRequest> = [
+  // /_local_image_:path
+  route('/_local_image_*', async (req, res, next) => {
+    const query = url.parse(req.url, true).query
+    const fileDir = await bufferDir(req, Number(query['bufnr']))
+    if (!fileDir) {
+      return next()
+    }
+    const image = decodeURIComponent(decodeURIComponent(req.asPath.replace(/^\/_local_image_/, ''))).replace(
+      /\\ /g,
+      ' '
+    )
+    const filepath = await resolveImage(fileDir, image)
+    if (!filepath) {
+      req.logger.error('image not exists: ', image)
+      return next()
+    }
+
+    const width = Math.min(Number(query['width']) || 0, THUMBNAIL_MAX_WIDTH)
+    const thumbnail = width > 0 ? await getThumbnail(filepath, width).catch(() => null) : null
+    if (thumbnail && (await serveFile(req, res, thumbnail))) {
+      return
+    }
+    if (await serveFile(req, res, filepath)) {
+      return
+    }
+    // moved or deleted since it was resolved
+    resolved.delete(`${fileDir}\0${image}`)
+    next()
+  }),
+]
+
+export default {
+  routes,
+}
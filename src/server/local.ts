@@ -1,12 +1,21 @@
 import wikiServer from './wiki'
-import bufferServer, {onWebsocketConnection} from './buffer'
-import {listener, LocalRequest} from './server'
+import bufferServer, {nextRefresh, scrollRefresh, onWebsocketConnection} from './buffer'
+import notesServer from './notes'
+import imagesServer from './images'
+import metricsServer from './metrics'
+import {compileRoutes, LocalRequest, notFound, staticRoutes} from './server'
 import opener from '../util/opener'
 import * as http from 'http'
 import websocket from 'socket.io'
 import {getIP} from '../util/getIP'
 import * as wiki from '../zortex/wiki'
 import {getArticleFilepath} from '../zortex/helpers'
+import {getConfig} from '../attach/state'
+import {getNotes} from '../zortex/notes'
+import {keepSnapshot} from '../zortex/snapshot'
+import {REFRESH_STAGE} from '../attach/scheduler'
+import {startTimer} from '../util/metrics'
+import {preloadAssets} from './assets'
 
 // TODO: move app/nvim.js to here?
 const openUrl = (plugin, url, browser = null) => {
@@ -25,10 +34,27 @@ const openUrl = (plugin, url, browser = null) => {
 export function run({plugin, logger}) {
   let clients = {}
 
-  // don't await to decrease startup time but requires awaiting any reference
-  const articles = plugin.nvim
-    .getVar('zortex_notes_dir')
-    .then((notesDir: string) => wiki.getArticles(notesDir))
+  const routes = compileRoutes<LocalRequest>(
+    [
+      ...wikiServer.routes,
+      ...bufferServer.routes,
+      ...notesServer.routes,
+      ...imagesServer.routes,
+      ...metricsServer.routes,
+      ...staticRoutes,
+    ],
+    notFound
+  )
+  preloadAssets(['./out', './_static']).catch((e) => logger.error('assets: ', e))
+
+  // start reading articles and notes without delaying startup
+  getConfig(plugin.nvim)
+    .then(async (config) => {
+      // seed the indexes from the last run before reading what changed since
+      await keepSnapshot(config.notesDir, config.extension)
+      await Promise.all([wiki.getArticles(config.notesDir), getNotes(config.notesDir, config.extension)])
+    })
+    .catch((e) => logger.error('articles: ', e))
 
   // http server
   const server = http.createServer(async (req: LocalRequest, res) => {
@@ -37,16 +63,18 @@ export function run({plugin, logger}) {
 
     // request path
     req.asPath = req.url.replace(/[?#].*$/, '')
-    req.mkcss = await plugin.nvim.getVar('zortex_markdown_css')
-    req.hicss = await plugin.nvim.getVar('zortex_highlight_css')
+    const config = await getConfig(plugin.nvim)
+    req.mkcss = config.markdownCss
+    req.hicss = config.highlightCss
 
     // zortex
-    req.notesDir = await plugin.nvim.getVar('zortex_notes_dir')
-    req.extension = await plugin.nvim.getVar('zortex_extension')
-    req.articles = await articles
+    req.notesDir = config.notesDir
+    req.extension = config.extension
+    req.articles = await wiki.getArticles(config.notesDir)
+    req.serverRender = !!config.serverRender
 
     // routes
-    listener(req, res, [...wikiServer.routes, ...bufferServer.routes])
+    routes(req, res)
   })
 
   // websocket server
@@ -64,15 +92,31 @@ export function run({plugin, logger}) {
     })
   })
 
-  function refreshPage({data}) {
-    logger.info('refresh page: ', data.name)
+  function broadcast(event: string, payload: any) {
     Object.values(clients).forEach((c: any) => {
       if (c.connected) {
-        c.emit('refresh_content', data)
+        c.emit(event, payload)
       }
     })
   }
 
+  function refreshPage({data}) {
+    logger.info('refresh page: ', data.name)
+    const serialized = startTimer(REFRESH_STAGE, {stage: 'serialize', source: 'notify'})
+    const {event, payload} = nextRefresh(data)
+    serialized()
+    const emitted = startTimer(REFRESH_STAGE, {stage: 'emit', source: 'notify'})
+    broadcast(event, payload)
+    emitted()
+  }
+
+  function refreshScroll({data}) {
+    const refresh = scrollRefresh(data)
+    if (refresh) {
+      broadcast(refresh.event, refresh.payload)
+    }
+  }
+
   async function openBrowser({}) {
     const openToTheWord = await plugin.nvim.getVar('zortex_open_to_the_world')
     let port = await plugin.nvim.getVar('zortex_port')
@@ -116,6 +160,7 @@ export function run({plugin, logger}) {
 
         plugin.init({
           refreshPage,
+          refreshScroll,
           openBrowser,
         })
 
@@ -0,0 +1,17 @@
+import {renderMetrics} from '../util/metrics'
+import {Routes, routeFor, ServerRequest} from './server'
+
+const route = routeFor<ServerRequest>()
+
+const routes: Routes<ServerRequest> = [
+  // /metrics, Prometheus text format
+  route('/metrics', (req, res) => {
+    res.setHeader('Content-Type', 'text/plain; version=0.0.4; charset=utf-8')
+    res.setHeader('Cache-Control', 'no-store')
+    return res.end(renderMetrics())
+  }),
+]
+
+export default {
+  routes,
+}
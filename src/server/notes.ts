@@ -0,0 +1,31 @@
+import * as url from 'url'
+import {getNotes, sourceNotes, SourceType} from '../zortex/notes'
+import {LocalRequest, Routes, routeFor} from './server'
+
+// lines written to the response at once
+const CHUNK_LINES = 256
+
+const route = routeFor<LocalRequest>()
+
+const routes: Routes<LocalRequest> = [
+  // /zortex/source?type
+  route('/zortex/source', async (req, res) => {
+    const type = url.parse(req.url, true).query['type'] as SourceType
+    const notes = sourceNotes((await getNotes(req.notesDir, req.extension)).values(), type)
+
+    res.setHeader('Content-Type', 'text/plain; charset=utf-8')
+    for (let i = 0; i < notes.length; i += CHUNK_LINES) {
+      res.write(
+        notes
+          .slice(i, i + CHUNK_LINES)
+          .map((note) => note.line + '\n')
+          .join('')
+      )
+    }
+    return res.end()
+  }),
+]
+
+export default {
+  routes,
+}
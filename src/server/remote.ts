@@ -1,21 +1,38 @@
-import {listener, RemoteRequest} from './server'
+import {compileRoutes, notFound, RemoteRequest, Routes, staticRoutes} from './server'
 import wikiServer from './wiki'
+import syncServer from './sync'
+import metricsServer from './metrics'
 import * as wiki from '../zortex/wiki'
+import {keepSnapshot} from '../zortex/snapshot'
+import {syncToken} from '../zortex/sync'
 import * as http from 'http'
+import {preloadAssets} from './assets'
 
 export function run({}) {
-  // don't await to decrease startup time but requires awaiting any reference
-  const articles = wiki.getArticles(process.env.NOTES_DIR)
+  const routes = compileRoutes<RemoteRequest>(
+    [...wikiServer.routes, ...syncServer.routes, ...metricsServer.routes, ...(staticRoutes as Routes<any>)],
+    notFound
+  )
+  preloadAssets(['./out', './_static']).catch(() => {})
+  // the token notes are synced with, read by the ssh side of syncNotes
+  syncToken(process.cwd()).catch(() => {})
+
+  // start reading articles without delaying startup, from the last run's
+  // snapshot when there is one
+  keepSnapshot(process.env.NOTES_DIR, process.env.EXTENSION)
+    .then(() => wiki.getArticles(process.env.NOTES_DIR))
+    .catch(() => {})
 
   const server = http.createServer(async (req: RemoteRequest, res) => {
     req.asPath = req.url.replace(/[?#].*$/, '')
 
     req.notesDir = process.env.NOTES_DIR
     req.extension = process.env.EXTENSION
-    req.articles = await articles
+    req.articles = await wiki.getArticles(process.env.NOTES_DIR)
+    req.serverRender = process.env.SERVER_RENDER === '1'
 
     // routes
-    listener<RemoteRequest>(req, res, wikiServer.routes)
+    routes(req, res)
   })
 
   async function startServer() {
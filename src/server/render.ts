@@ -0,0 +1,65 @@
+import * as crypto from 'crypto'
+import * as path from 'path'
+
+const logger = require('../util/logger')('server/render') // tslint:disable-line
+
+/*
+ * Server render mode (g:zortex_server_render), for clients too slow to run
+ * markdown-it, katex and highlight.js themselves, e.g. phones on the remote
+ * wiki.
+ *
+ * Markdown is rendered by the plugin set of the app, bundled for node into
+ * lib/markdown.js by `yarn build-render`, one top-level block at a time (see
+ * app/components/markdown/blocks.js). Blocks are keyed by a hash of their
+ * source, and clients keep the blocks they have, so only the html of blocks
+ * they don't have yet is sent.
+ */
+
+export interface RenderedBlock {
+  // null for blocks depending on the rest of the document, always sent
+  key: string | null
+  start: number
+  // left out when the client has the block
+  html?: string
+}
+
+type BlockRenderer = (src: string) => {blocks: {key: string | null; start: number; html: string}[]}
+
+let renderer: BlockRenderer = null
+let unavailable = false
+
+function getRenderer() {
+  if (!renderer && !unavailable) {
+    try {
+      const {initMarkdown, createBlockRenderer} = require(path.join(__dirname, '../markdown')) // tslint:disable-line
+      renderer = createBlockRenderer(initMarkdown())
+    } catch (e) {
+      // clients render the lines themselves
+      unavailable = true
+      logger.error('server render unavailable, run `yarn build-render`: ', e)
+    }
+  }
+  return renderer
+}
+
+const hashKey = (key: string) => crypto.createHash('sha1').update(key).digest('base64').slice(0, 20)
+
+/**
+ * Rendered blocks of `lines`, without the html of those whose key is in
+ * `known`, null when they can't be rendered here
+ */
+export function renderBlocks(lines: string[], known?: Set<string>): RenderedBlock[] | null {
+  const render = getRenderer()
+  if (!render) {
+    return null
+  }
+  try {
+    return render(lines.join('\n')).blocks.map(({key, start, html}) => {
+      const hash = key === null ? null : hashKey(key)
+      return hash !== null && known?.has(hash) ? {key: hash, start} : {key: hash, start, html}
+    })
+  } catch (e) {
+    logger.error('server render: ', e)
+    return null
+  }
+}
@@ -1,10 +1,11 @@
-import * as fs from 'fs'
 import * as path from 'path'
 
 import {Logger} from 'log4js'
 import {IPlugin} from '../attach'
 import {IncomingMessage, ServerResponse} from 'http'
 import {Articles} from '../zortex/wiki'
+import {serveFile} from './assets'
+import {histogram, observe, sizeBuckets} from '../util/metrics'
 
 export type RemoteRequest = IncomingMessage & {
   asPath: string
@@ -12,13 +13,14 @@ export type RemoteRequest = IncomingMessage & {
   extension: string
   notesDir: string
   articles: Articles
+  // render articles on the server, see render.ts
+  serverRender: boolean
 }
 
 export type LocalRequest = IncomingMessage & {
   plugin: IPlugin
   logger: Logger
 
-  bufnr: string
   asPath: string
 
   mkcss: string
@@ -27,117 +29,241 @@ export type LocalRequest = IncomingMessage & {
   notesDir: string
   extension: string
   articles: Articles
+  serverRender: boolean
 }
 
 export type ServerRequest = RemoteRequest | LocalRequest
 
-export type Route<Request> = (req: Request, res: ServerResponse, next: () => Route<Request>) => any
+export type Params = {[name: string]: string}
+
+// params of a route path: `:name` segments, and `*` for the rest of the path
+export type PathParams<Path extends string> = Path extends `${string}:${infer Param}/${infer Rest}`
+  ? {[K in Param]: string} & PathParams<Rest>
+  : Path extends `${string}:${infer Param}`
+  ? {[K in Param]: string}
+  : Path extends `${string}*`
+  ? {'*': string}
+  : {}
+
+export type Handler<Request, P = Params> = (req: Request, res: ServerResponse, next: () => void, params: P) => any
+
+export interface Route<Request> {
+  path: string
+  handler: Handler<Request, any>
+}
 export type Routes<Request> = Route<Request>[]
 
-export function listener<Request>(req: Request, res: ServerResponse, routes: Routes<Request>) {
-  // TODO: extract the map to outside http.createServer() to speed up each request
-  ;[...routes, ...staticRoutes]
-    .reverse()
-    .map(route => (req, res, next) => () => route(req, res, next))
-    .reduce((next, route) => route(req, res, next), undefined as any)()
+/**
+ * Route builder for `Request`, typing the params of the handler from its path
+ */
+export const routeFor = <Request>() => <Path extends string>(
+  path: Path,
+  handler: Handler<Request, PathParams<Path>>
+): Route<Request> => ({path, handler})
+
+/*
+ * Routes are compiled once into a trie of path segments. A segment is
+ * matched literally, by a `:param`, or by a final `prefix*` matching the rest
+ * of the path from a segment starting with `prefix`. A request goes to the
+ * most specific route first (literal, then param, then rest of the path) and
+ * `next()` passes it to the following candidate, then to the fallback.
+ */
+
+interface Candidate<Request> {
+  route: Route<Request>
+  params: Params
 }
 
-export const staticRoutes: Routes<LocalRequest> = [
-  // /resources
-  (req, res, next) => {
-    if (/\/resources/.test(req.asPath)) {
-      const filepath = path.join(req.notesDir, req.asPath)
-      if (fs.existsSync(filepath)) {
-        return fs.createReadStream(filepath).pipe(res)
+interface RouteNode<Request> {
+  literals: Map<string, RouteNode<Request>>
+  param: null | {name: string; node: RouteNode<Request>}
+  rests: {prefix: string; routes: Route<Request>[]}[]
+  routes: Route<Request>[]
+}
+
+const REQUEST_DURATION = 'zortex_http_request_duration_seconds'
+const RESPONSE_SIZE = 'zortex_http_response_bytes'
+histogram(REQUEST_DURATION, 'Seconds to answer HTTP requests, by route and status')
+histogram(RESPONSE_SIZE, 'Bytes of HTTP response bodies, by route', sizeBuckets)
+
+const createNode = <Request>(): RouteNode<Request> => ({literals: new Map(), param: null, rests: [], routes: []})
+
+function addRoute<Request>(root: RouteNode<Request>, route: Route<Request>) {
+  const routePath = route.path
+  const segments = routePath.split('/').filter((segment) => segment.length > 0)
+  let node = root
+  for (let i = 0; i < segments.length; i++) {
+    const segment = segments[i]
+    if (segment.endsWith('*')) {
+      if (i !== segments.length - 1) {
+        throw new Error(`route ${routePath}: * must end the path`)
+      }
+      const prefix = segment.slice(0, -1)
+      let rest = node.rests.find((r) => r.prefix === prefix)
+      if (!rest) {
+        rest = {prefix, routes: []}
+        node.rests.push(rest)
+      }
+      rest.routes.push(route)
+      return
+    }
+    if (segment.startsWith(':')) {
+      const name = segment.slice(1)
+      if (!node.param) {
+        node.param = {name, node: createNode()}
+      } else if (node.param.name !== name) {
+        throw new Error(`route ${routePath}: :${name} conflicts with :${node.param.name}`)
+      }
+      node = node.param.node
+    } else {
+      if (!node.literals.has(segment)) {
+        node.literals.set(segment, createNode())
+      }
+      node = node.literals.get(segment)
+    }
+  }
+  node.routes.push(route)
+}
+
+function collect<Request>(
+  node: RouteNode<Request>,
+  segments: string[],
+  i: number,
+  params: Params,
+  out: Candidate<Request>[]
+) {
+  if (i === segments.length) {
+    node.routes.forEach((route) => out.push({route, params}))
+    return
+  }
+  const segment = segments[i]
+  const literal = node.literals.get(segment)
+  if (literal) {
+    collect(literal, segments, i + 1, params, out)
+  }
+  if (node.param) {
+    collect(node.param.node, segments, i + 1, {...params, [node.param.name]: segment}, out)
+  }
+  for (const {prefix, routes} of node.rests) {
+    if (segment.startsWith(prefix)) {
+      const rest = {...params, '*': [segment.slice(prefix.length), ...segments.slice(i + 1)].join('/')}
+      routes.forEach((route) => out.push({route, params: rest}))
+    }
+  }
+}
+
+// count the body bytes written to `res`
+function countBytes(res: ServerResponse) {
+  let bytes = 0
+  const count = (chunk: any, encoding: any) => {
+    if (typeof chunk === 'string') {
+      bytes += Buffer.byteLength(chunk, typeof encoding === 'string' ? encoding : 'utf8')
+    } else if (chunk && typeof chunk !== 'function') {
+      bytes += chunk.length
+    }
+  }
+  const {write, end} = res
+  res.write = function (chunk: any, encoding?: any) {
+    count(chunk, encoding)
+    return write.apply(this, arguments)
+  }
+  res.end = function (chunk?: any, encoding?: any) {
+    count(chunk, encoding)
+    return end.apply(this, arguments)
+  }
+  return () => bytes
+}
+
+/**
+ * Compile `routes` into a request listener, `fallback` answers requests no
+ * route handled
+ */
+export function compileRoutes<Request extends {asPath: string}>(
+  routes: Routes<Request>,
+  fallback: Handler<Request, {}>
+) {
+  const root = createNode<Request>()
+  routes.forEach((route) => addRoute(root, route))
+
+  return (req: Request, res: ServerResponse) => {
+    const candidates: Candidate<Request>[] = []
+    collect(root, req.asPath.split('/').filter((segment) => segment.length > 0), 0, {}, candidates)
+    const start = process.hrtime.bigint()
+    const bytes = countBytes(res)
+    // path of the route which answered
+    let answered = '404'
+    res.once('finish', () => {
+      const seconds = Number(process.hrtime.bigint() - start) / 1e9
+      observe(REQUEST_DURATION, {route: answered, status: String(res.statusCode)}, seconds)
+      observe(RESPONSE_SIZE, {route: answered}, bytes())
+    })
+
+    let i = 0
+    const next = () => {
+      const candidate = candidates[i++]
+      if (candidate) {
+        answered = candidate.route.path
+        candidate.route.handler(req, res, next, candidate.params)
       } else {
-        return fs.createReadStream(path.join('./out', '404.html')).pipe(res)
+        answered = '404'
+        fallback(req, res, () => undefined, {})
       }
     }
     next()
-  },
+  }
+}
+
+const route = routeFor<LocalRequest>()
+
+export const staticRoutes: Routes<LocalRequest> = [
+  // /resources
+  route('/resources/*', async (req, res) => {
+    if (!(await serveFile(req, res, path.join(req.notesDir, req.asPath)))) {
+      return notFound(req, res, () => undefined, {})
+    }
+  }),
+
+  // /_next/static/path, file names are hashed
+  route('/_next/static/*', async (req, res, next) => {
+    if (!(await serveFile(req, res, path.join('./out', req.asPath), {immutable: true}))) {
+      next()
+    }
+  }),
 
   // /_next/path
-  (req, res, next) => {
-    if (/\/_next/.test(req.asPath)) {
-      return fs.createReadStream(path.join('./out', req.asPath)).pipe(res)
+  route('/_next/*', async (req, res, next) => {
+    if (!(await serveFile(req, res, path.join('./out', req.asPath)))) {
+      next()
     }
-    next()
-  },
+  }),
 
   // /_static/markdown.css
+  route('/_static/markdown.css', async (req, res, next) => {
+    if (!(req.mkcss && (await serveFile(req, res, req.mkcss)))) {
+      next()
+    }
+  }),
+
   // /_static/highlight.css
-  (req, res, next) => {
-    try {
-      if (req.mkcss && req.asPath === '/_static/markdown.css') {
-        if (fs.existsSync(req.mkcss)) {
-          return fs.createReadStream(req.mkcss).pipe(res)
-        }
-      } else if (req.hicss && req.asPath === '/_static/highlight.css') {
-        if (fs.existsSync(req.hicss)) {
-          return fs.createReadStream(req.hicss).pipe(res)
-        }
-      }
-    } catch (e) {
-      req.logger.error('load diy css fail: ', req.asPath, req.mkcss, req.hicss)
+  route('/_static/highlight.css', async (req, res, next) => {
+    if (!(req.hicss && (await serveFile(req, res, req.hicss)))) {
+      next()
     }
-    next()
-  },
+  }),
 
   // /_static/path
-  (req, res, next) => {
-    if (/\/_static/.test(req.asPath)) {
-      const fpath = path.join('./', req.asPath)
-      if (fs.existsSync(fpath)) {
-        return fs.createReadStream(fpath).pipe(res)
-      } else {
-        req.logger.error('No such file:', req.asPath, req.mkcss, req.hicss)
-      }
-    }
-    next()
-  },
-
-  // images
-  async (req, res, next) => {
-    req.logger.info('image route: ', req.asPath)
-    const reg = /^\/_local_image_/
-    if (reg.test(req.asPath) && req.asPath !== '') {
-      const plugin = req.plugin
-      const buffers = await plugin.nvim.buffers
-      const buffer = buffers.find(b => b.id === Number(req.bufnr))
-      if (buffer) {
-        const fileDir = await plugin.nvim.call('expand', `#${req.bufnr}:p:h`)
-        req.logger.info('fileDir', fileDir)
-        let imgPath = decodeURIComponent(decodeURIComponent(req.asPath.replace(reg, '')))
-        imgPath = imgPath.replace(/\\ /g, ' ')
-        if (imgPath[0] !== '/' && imgPath[0] !== '\\') {
-          imgPath = path.join(fileDir, imgPath)
-        } else if (!fs.existsSync(imgPath)) {
-          let tmpDirPath = fileDir
-          while (tmpDirPath !== '/' && tmpDirPath !== '\\') {
-            tmpDirPath = path.normalize(path.join(tmpDirPath, '..'))
-            let tmpImgPath = path.join(tmpDirPath, imgPath)
-            if (fs.existsSync(tmpImgPath)) {
-              imgPath = tmpImgPath
-              break
-            }
-          }
-        }
-        req.logger.info('imgPath', imgPath)
-        if (fs.existsSync(imgPath) && !fs.statSync(imgPath).isDirectory()) {
-          if (imgPath.endsWith('svg')) {
-            res.setHeader('content-type', 'image/svg+xml')
-          }
-          return fs.createReadStream(imgPath).pipe(res)
-        }
-        req.logger.error('image not exists: ', imgPath)
-      }
+  route('/_static/*', async (req, res, next) => {
+    if (!(await serveFile(req, res, path.join('./', req.asPath)))) {
+      req.logger.error('No such file:', req.asPath, req.mkcss, req.hicss)
+      next()
     }
-    next()
-  },
+  }),
+]
 
-  // 404
-  (req, res) => {
+// 404
+export const notFound: Handler<ServerRequest, {}> = async (req, res) => {
+  if (!(await serveFile(req, res, path.join('./out', '404.html'), {statusCode: 404}))) {
     res.statusCode = 404
-    return fs.createReadStream(path.join('./out', '404.html')).pipe(res)
-  },
-]
+    res.end()
+  }
+}
@@ -0,0 +1,33 @@
+import {applyChanges, checkToken, isLoopback, TOKEN_HEADER} from '../zortex/sync'
+import {RemoteRequest, Routes, routeFor} from './server'
+
+const logger = require('../util/logger')('server/sync') // tslint:disable-line
+
+const route = routeFor<RemoteRequest>()
+
+const routes: Routes<RemoteRequest> = [
+  // POST /zortex/sync, changes sent by syncNotes through ssh
+  route('/zortex/sync', async (req, res, next) => {
+    // only reachable from the remote host itself
+    if (req.method !== 'POST' || !isLoopback(req.socket.remoteAddress)) {
+      return next()
+    }
+    if (!(await checkToken(process.cwd(), req.headers[TOKEN_HEADER]))) {
+      res.statusCode = 403
+      return res.end()
+    }
+    try {
+      const result = await applyChanges(req.notesDir, req.extension, req)
+      res.setHeader('Content-Type', 'application/json')
+      return res.end(JSON.stringify(result, null, 0))
+    } catch (e) {
+      logger.error('sync: ', e)
+      res.statusCode = 400
+      return res.end(e.message)
+    }
+  }),
+]
+
+export default {
+  routes,
+}
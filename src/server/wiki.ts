@@ -1,75 +1,113 @@
-import * as fs from 'fs'
+import * as path from 'path'
 import * as url from 'url'
-import {findArticle, searchArticles} from '../zortex/wiki'
-import {getArticleStructures, getMatchingStructures} from '../zortex/structures'
-import {ServerRequest, Routes} from './server'
+import {findArticle} from '../zortex/wiki'
+import {search} from '../zortex/search'
+import {serializeZettel} from '../zortex/zettel'
+import {getZettels} from '../zortex/store'
+import {weightedRelatedTags} from '../zortex/helpers'
+import {getMatchingStructures, getStructureIndex} from '../zortex/structures'
+import {serveFile} from './assets'
+import {renderBlocks} from './render'
+import {ServerRequest, Routes, routeFor} from './server'
+
+const route = routeFor<ServerRequest>()
 
 const routes: Routes<ServerRequest> = [
   // /wiki/structures/:name
-  async (req, res, next) => {
-    let match: null | string[]
-    if (match = req.asPath.match(/wiki\/structures\/([^/]+)/)) {
-      const articleName = match[1]
-      const notesDir = req.notesDir
-      const extension = req.extension
-      const structures = await getArticleStructures(notesDir, extension)
-      const matchingStructures = getMatchingStructures(articleName, structures)
-
-      res.setHeader('Content-Type', 'application/json')
-      return res.end(
-        JSON.stringify(
-          matchingStructures,
-          null,
-          0
-        )
+  route('/wiki/structures/:name', async (req, res, next, params) => {
+    const articleName = params.name
+    const notesDir = req.notesDir
+    const extension = req.extension
+    const index = await getStructureIndex(notesDir, extension)
+    const matchingStructures = getMatchingStructures(articleName, index)
+
+    res.setHeader('Content-Type', 'application/json')
+    return res.end(
+      JSON.stringify(
+        matchingStructures,
+        null,
+        0
       )
-    }
-    next()
-  },
+    )
+  }),
 
   // /wiki/article/:name
-  async (req, res, next) => {
-    let match: null | string[]
-    if (match = req.asPath.match(/wiki\/article\/([^/]+)/)) {
-      const articleName = match[1]
-      const notesDir = req.notesDir
-      const extension = req.extension
-
-      res.setHeader('Content-Type', 'application/json')
-      return res.end(
-        JSON.stringify(
-          await findArticle(notesDir, extension, articleName, req.articles),
-          null,
-          0
-        )
+  route('/wiki/article/:name', async (req, res, next, params) => {
+    const articleName = params.name
+    const notesDir = req.notesDir
+    const extension = req.extension
+    const article = await findArticle(notesDir, extension, articleName, req.articles)
+    // rendered blocks replace the lines, which the page renders otherwise
+    const blocks = req.serverRender && article ? renderBlocks(article.content) : null
+
+    res.setHeader('Content-Type', 'application/json')
+    return res.end(
+      JSON.stringify(
+        blocks ? {...article, content: undefined, blocks} : article,
+        null,
+        0
       )
+    )
+  }),
+
+  // /wiki/zettel/:id
+  route('/wiki/zettel/:id', async (req, res, next, params) => {
+    const id = decodeURIComponent(params.id)
+    const zettels = await getZettels(path.join(req.notesDir, 'zettels' + req.extension))
+
+    res.setHeader('Content-Type', 'application/json')
+    return res.end(JSON.stringify(serializeZettel(id, zettels), null, 0))
+  }),
+
+  // /wiki/zettels?ids=id1,id2
+  route('/wiki/zettels', async (req, res) => {
+    const searchParams = url.parse(req.url, true).query
+    let ids = searchParams['ids'] || []
+    if (!Array.isArray(ids)) {
+      ids = [ids]
     }
-    next()
-  },
-
-  // /wiki/search?query
-  (req, res, next) => {
-    if (/\/wiki\/search/.test(req.asPath)) {
-      const searchParams = url.parse(req.url, true).query
-      let searchQuery = searchParams['query']
-      if (Array.isArray(searchQuery)) {
-        searchQuery = searchQuery.join(' ')
-      }
-
-      const articles = searchArticles(req.articles, searchQuery)
-      res.setHeader('Content-Type', 'application/json')
-      return res.end(JSON.stringify(articles, null, 0))
+    ids = ids.flatMap((id) => id.split(',')).filter((id) => id)
+
+    const zettels = await getZettels(path.join(req.notesDir, 'zettels' + req.extension))
+    const results = ids.reduce((acc, id) => {
+      acc[id] = serializeZettel(id, zettels)
+      return acc
+    }, {})
+
+    res.setHeader('Content-Type', 'application/json')
+    return res.end(JSON.stringify(results, null, 0))
+  }),
+
+  // /wiki/related/:tag?limit
+  route('/wiki/related/:tag', async (req, res, next, params) => {
+    const tag = decodeURIComponent(params.tag)
+    const limit = Number(url.parse(req.url, true).query['limit']) || undefined
+    const zettels = await getZettels(path.join(req.notesDir, 'zettels' + req.extension))
+
+    res.setHeader('Content-Type', 'application/json')
+    return res.end(JSON.stringify(weightedRelatedTags(zettels, tag, limit), null, 0))
+  }),
+
+  // /wiki/search?query&limit
+  route('/wiki/search', async (req, res) => {
+    const searchParams = url.parse(req.url, true).query
+    let searchQuery = searchParams['query'] || ''
+    if (Array.isArray(searchQuery)) {
+      searchQuery = searchQuery.join(' ')
     }
-    next()
-  },
+    const limit = Number(searchParams['limit']) || undefined
+
+    const results = await search(req.notesDir, req.extension, searchQuery, limit)
+    res.setHeader('Content-Type', 'application/json')
+    return res.end(JSON.stringify(results, null, 0))
+  }),
 
   // /wiki/:name
-  (req, res, next) => {
-    if (/\/wiki\/([^/]+)/.test(req.asPath)) {
-      return fs.createReadStream('./out/wiki.html').pipe(res)
+  route('/wiki/:name', async (req, res, next) => {
+    if (!(await serveFile(req, res, './out/wiki.html'))) {
+      next()
     }
-    next()
-  },
+  }),
 ]
 
 export default {
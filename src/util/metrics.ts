@@ -0,0 +1,176 @@
+/*
+ * Histograms and counters of the hot paths, rendered in the Prometheus text
+ * format for /metrics and as a summary for :ZortexStats.
+ *
+ * Histograms have fixed buckets, so observing a value is a few comparisons
+ * and no allocation once its label set was seen.
+ */
+
+export type Labels = {[name: string]: string}
+
+interface Series {
+  labels: Labels
+  counts: number[]
+  sum: number
+  count: number
+}
+
+interface Histogram {
+  help: string
+  buckets: number[]
+  // label values joined -> series
+  series: Map<string, Series>
+}
+
+interface Counter {
+  help: string
+  collect: () => {labels: Labels; value: number}[]
+}
+
+// seconds
+export const durationBuckets = [0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10]
+// bytes
+export const sizeBuckets = [256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216]
+
+const histograms = new Map<string, Histogram>()
+const counters = new Map<string, Counter>()
+
+const labelsKey = (labels: Labels) => Object.keys(labels).map((name) => labels[name]).join('\0')
+
+const escapeLabel = (value: string) => value.replace(/\\/g, '\\\\').replace(/\n/g, '\\n').replace(/"/g, '\\"')
+
+function renderLabels(labels: Labels, extra?: Labels) {
+  const all = {...labels, ...extra}
+  const names = Object.keys(all)
+  return names.length === 0 ? '' : `{${names.map((name) => `${name}="${escapeLabel(all[name])}"`).join(',')}}`
+}
+
+/**
+ * Declare the histogram `name`, declaring it again keeps its series
+ */
+export function histogram(name: string, help: string, buckets = durationBuckets) {
+  if (!histograms.has(name)) {
+    histograms.set(name, {help, buckets, series: new Map()})
+  }
+}
+
+/**
+ * Declare the counters of `name`, read from `collect` when rendering
+ */
+export function counter(name: string, help: string, collect: Counter['collect']) {
+  counters.set(name, {help, collect})
+}
+
+export function observe(name: string, labels: Labels, value: number) {
+  const metric = histograms.get(name)
+  if (!metric) {
+    return
+  }
+  const key = labelsKey(labels)
+  let series = metric.series.get(key)
+  if (!series) {
+    series = {labels, counts: new Array(metric.buckets.length).fill(0), sum: 0, count: 0}
+    metric.series.set(key, series)
+  }
+  for (let i = 0; i < metric.buckets.length; i++) {
+    if (value <= metric.buckets[i]) {
+      series.counts[i]++
+      break
+    }
+  }
+  series.sum += value
+  series.count++
+}
+
+/**
+ * Start timing, the returned function observes the seconds elapsed
+ */
+export function startTimer(name: string, labels: Labels) {
+  const start = process.hrtime.bigint()
+  return () => {
+    const seconds = Number(process.hrtime.bigint() - start) / 1e9
+    observe(name, labels, seconds)
+    return seconds
+  }
+}
+
+/**
+ * Observe the seconds taken by `fn`, also when it throws
+ */
+export async function time<T>(name: string, labels: Labels, fn: () => T | Promise<T>): Promise<T> {
+  const done = startTimer(name, labels)
+  try {
+    return await fn()
+  } finally {
+    done()
+  }
+}
+
+/**
+ * All metrics in the Prometheus text exposition format
+ */
+export function renderMetrics() {
+  const lines: string[] = []
+  histograms.forEach((metric, name) => {
+    lines.push(`# HELP ${name} ${metric.help}`, `# TYPE ${name} histogram`)
+    metric.series.forEach((series) => {
+      let cumulative = 0
+      metric.buckets.forEach((bucket, i) => {
+        cumulative += series.counts[i]
+        lines.push(`${name}_bucket${renderLabels(series.labels, {le: String(bucket)})} ${cumulative}`)
+      })
+      lines.push(`${name}_bucket${renderLabels(series.labels, {le: '+Inf'})} ${series.count}`)
+      lines.push(`${name}_sum${renderLabels(series.labels)} ${series.sum}`)
+      lines.push(`${name}_count${renderLabels(series.labels)} ${series.count}`)
+    })
+  })
+  counters.forEach((metric, name) => {
+    lines.push(`# HELP ${name} ${metric.help}`, `# TYPE ${name} counter`)
+    metric.collect().forEach(({labels, value}) => lines.push(`${name}${renderLabels(labels)} ${value}`))
+  })
+  return lines.join('\n') + '\n'
+}
+
+// upper bound of the bucket holding the `q` quantile
+function quantile(buckets: number[], series: Series, q: number) {
+  const rank = q * series.count
+  let cumulative = 0
+  for (let i = 0; i < buckets.length; i++) {
+    cumulative += series.counts[i]
+    if (cumulative >= rank) {
+      return buckets[i]
+    }
+  }
+  return Infinity
+}
+
+const formatValue = (name: string, value: number) => {
+  if (!isFinite(value)) {
+    return 'inf'
+  }
+  if (name.endsWith('_bytes')) {
+    return value >= 1024 ? `${(value / 1024).toFixed(1)}KB` : `${Math.round(value)}B`
+  }
+  return value >= 1 ? `${value.toFixed(2)}s` : `${(value * 1000).toFixed(1)}ms`
+}
+
+/**
+ * One line per series: count, mean and bucket bounds of p50 and p99
+ */
+export function summarizeMetrics() {
+  const lines: string[] = []
+  histograms.forEach((metric, name) => {
+    metric.series.forEach((series) => {
+      const mean = series.count ? series.sum / series.count : 0
+      lines.push(
+        `${name}${renderLabels(series.labels)} count=${series.count} mean=${formatValue(name, mean)} ` +
+          `p50<=${formatValue(name, quantile(metric.buckets, series, 0.5))} ` +
+          `p99<=${formatValue(name, quantile(metric.buckets, series, 0.99))}`
+      )
+    })
+  })
+  counters.forEach((metric, name) => {
+    metric.collect().forEach(({labels, value}) => lines.push(`${name}${renderLabels(labels)} ${value}`))
+  })
+  return lines
+}
@@ -0,0 +1,158 @@
+import * as fs from 'fs'
+import * as net from 'net'
+import * as path from 'path'
+import * as readline from 'readline'
+import {Env} from './types'
+import {indexCategories, populateHub} from './zettel'
+import {getZettels} from './store'
+import {fetchQuery, parseQuery} from './query'
+import {missingTags, readLines, weightedRelatedTags} from './helpers'
+
+/*
+ * Long-running CLI mode answering JSON lines, so scripts and editors index
+ * the zettels once for any number of requests.
+ *
+ *   zortex --batch                 requests on stdin, answers on stdout
+ *   zortex --socket /tmp/z.sock    the same for each client of a Unix socket
+ *
+ * A request is {"id": 1, "method": "query", "params": {"query": "% #tag#"}}
+ * and its answer {"id": 1, "result": ...} or {"id": 1, "error": "..."}, in
+ * the order of the requests of a stream. The zettels are brought up to date
+ * before each request, which only parses what changed since the last one.
+ */
+
+export interface BatchRequest {
+  id?: number | string
+  method: string
+  params?: {[name: string]: any}
+}
+
+export interface BatchResponse {
+  id: number | string | null
+  result?: any
+  error?: string
+}
+
+interface Categories {
+  mtimeMs: number
+  size: number
+  graph: {[key: string]: string[]}
+}
+
+type Method = (env: Env, params: BatchRequest['params']) => any
+
+// by categories file
+const categories = new Map<string, Categories>()
+
+function notePath(env: Env, note: string) {
+  if (typeof note !== 'string' || note === '') {
+    throw new Error('missing note')
+  }
+  return path.resolve(env.projectDir, note)
+}
+
+async function getCategories(filepath: string) {
+  const stat = await fs.promises.stat(filepath)
+  const cached = categories.get(filepath)
+  if (cached && cached.mtimeMs === stat.mtimeMs && cached.size === stat.size) {
+    return cached.graph
+  }
+  const graph = await indexCategories(filepath)
+  categories.set(filepath, {mtimeMs: stat.mtimeMs, size: stat.size, graph})
+  return graph
+}
+
+const methods: {[method: string]: Method} = {
+  // ids of the zettels matching params.query, with their tags and content
+  // when params.zettels is set
+  query: (env, {query, zettels}) => {
+    const parsed = typeof query === 'string' && parseQuery(query.startsWith('%') ? query : `% ${query}`)
+    if (!parsed) {
+      throw new Error(`invalid query: ${query}`)
+    }
+    const ids = fetchQuery(parsed, env.zettels)
+    if (!zettels) {
+      return ids
+    }
+    return ids.map((id) => {
+      const zettel = env.zettels.ids[id]
+      return {id, tags: [...zettel.tags], content: zettel.content, lineNumber: zettel.lineNumber}
+    })
+  },
+  relatedTags: (env, {tag, limit}) => {
+    if (typeof tag !== 'string') {
+      throw new Error('missing tag')
+    }
+    return weightedRelatedTags(env.zettels, tag, limit || Infinity)
+  },
+  tags: (env) => {
+    const counts = {}
+    for (const [tag, ids] of Object.entries(env.zettels.tags)) {
+      counts[tag] = ids.size
+    }
+    return counts
+  },
+  missingTags: (env, {note}) => missingTags(env.zettels, notePath(env, note)),
+  populate: (env, {note}) => populateHub(readLines(notePath(env, note)), env.zettels, env.projectDir),
+  categories: (env, {file}) =>
+    getCategories(path.resolve(env.projectDir, typeof file === 'string' ? file : 'categories' + env.extension)),
+}
+
+async function answer(env: Env, line: string): Promise<BatchResponse> {
+  let request: BatchRequest
+  try {
+    request = JSON.parse(line)
+  } catch (e) {
+    return {id: null, error: `invalid request: ${e.message}`}
+  }
+  const id = request?.id ?? null
+  const method = methods.hasOwnProperty(request?.method) ? methods[request.method] : null
+  if (!method) {
+    return {id, error: `unknown method: ${request?.method}`}
+  }
+  try {
+    env.zettels = await getZettels(env.zettelsFile)
+    return {id, result: await method(env, request.params || {})}
+  } catch (e) {
+    return {id, error: e.message}
+  }
+}
+
+/**
+ * Answer the JSON lines of `input` on `output` until `input` ends
+ */
+export async function serveStream(env: Env, input: NodeJS.ReadableStream, output: NodeJS.WritableStream) {
+  const lines = readline.createInterface({input, crlfDelay: Infinity})
+  for await (const line of lines) {
+    if (line.trim() === '') {
+      continue
+    }
+    const response = await answer(env, line)
+    if (!output.write(JSON.stringify(response) + '\n')) {
+      await new Promise((resolve) => output.once('drain', resolve))
+    }
+  }
+}
+
+/**
+ * Answer the clients of a Unix socket at `socketPath` until the process is stopped
+ */
+export async function serveSocket(env: Env, socketPath: string) {
+  // left behind by a server which didn't exit cleanly
+  await fs.promises.rm(socketPath, {force: true})
+  const server = net.createServer((socket) => {
+    socket.on('error', () => undefined)
+    serveStream(env, socket, socket)
+      .catch((e) => console.error(e))
+      .finally(() => socket.end())
+  })
+  await new Promise<void>((resolve, reject) => {
+    server.once('error', reject)
+    server.listen(socketPath, resolve)
+  })
+
+  const close = () => server.close(() => process.exit())
+  process.once('SIGINT', close)
+  process.once('SIGTERM', close)
+  return new Promise<void>((resolve) => server.on('close', resolve))
+}
@@ -0,0 +1,340 @@
+import * as fs from 'fs'
+import * as path from 'path'
+import {Article, Articles, parseArticleTitle, slugifyArticleName} from './wiki'
+
+const logger = require('../util/logger')('zortex/catalog') // tslint:disable-line
+
+/*
+ * Articles of a notes directory, read once and kept current by watching the
+ * directory. Each article is found by its slug without reading any file.
+ */
+
+// first line of a file as of its mtime and size
+export interface FileHeader {
+  mtimeMs: number
+  size: number
+  line: string
+}
+
+/**
+ * Catalog saved to disk, file name -> header
+ */
+export type CatalogSnapshot = {[fileName: string]: FileHeader}
+
+interface Catalog {
+  articles: Articles
+  headers: CatalogSnapshot
+  // lower case slug -> file name, slugs are compared case insensitively
+  files: {[slug: string]: string}
+  // file name -> slug of the article it defines
+  slugs: {[fileName: string]: string}
+  // file name -> number of reads started, to discard outdated reads
+  reads: {[fileName: string]: number}
+  timers: {[fileName: string]: NodeJS.Timeout}
+  watcher: fs.FSWatcher | null
+}
+
+// number of files read at the same time when building a catalog
+const CONCURRENCY = 32
+// time to wait for more events on a file before reading it again
+const WATCH_DELAY = 50
+const CHUNK_SIZE = 1024
+
+const catalogs: {[notesDir: string]: Promise<Catalog>} = {}
+// saved headers to build the next catalog from
+const savedCatalogs: {[notesDir: string]: CatalogSnapshot} = {}
+const listeners: {[notesDir: string]: Set<(fileName: string) => void>} = {}
+
+/**
+ * First line of a file, without the line ending
+ */
+export async function readFirstLine(filepath: string): Promise<string> {
+  const handle = await fs.promises.open(filepath, 'r')
+  try {
+    const chunks: Buffer[] = []
+    let position = 0
+    while (true) {
+      const chunk = Buffer.alloc(CHUNK_SIZE)
+      const {bytesRead} = await handle.read(chunk, 0, CHUNK_SIZE, position)
+      const newline = chunk.indexOf(10)
+      if (newline !== -1 && newline < bytesRead) {
+        chunks.push(chunk.slice(0, newline))
+        break
+      }
+      chunks.push(chunk.slice(0, bytesRead))
+      if (bytesRead < CHUNK_SIZE) {
+        break
+      }
+      position += bytesRead
+    }
+    return Buffer.concat(chunks).toString('utf8').replace(/\r$/, '')
+  } finally {
+    await handle.close()
+  }
+}
+
+/**
+ * Leading lines of a file as long as `inHeader` accepts them, without the
+ * line endings. The file is read in small chunks and only up to the first
+ * line not accepted.
+ */
+export async function readHeaderLines(filepath: string, inHeader: (line: string) => boolean): Promise<string[]> {
+  const handle = await fs.promises.open(filepath, 'r')
+  try {
+    const lines: string[] = []
+    let rest = Buffer.alloc(0)
+    let position = 0
+    while (true) {
+      const chunk = Buffer.alloc(CHUNK_SIZE)
+      const {bytesRead} = await handle.read(chunk, 0, CHUNK_SIZE, position)
+      position += bytesRead
+      let data = Buffer.concat([rest, chunk.slice(0, bytesRead)])
+
+      let newline = data.indexOf(10)
+      while (newline !== -1) {
+        const line = data.toString('utf8', 0, newline).replace(/\r$/, '')
+        if (!inHeader(line)) {
+          return lines
+        }
+        lines.push(line)
+        data = data.slice(newline + 1)
+        newline = data.indexOf(10)
+      }
+      rest = data
+
+      if (bytesRead < CHUNK_SIZE) {
+        const line = rest.toString('utf8').replace(/\r$/, '')
+        if (line.length > 0 && inHeader(line)) {
+          lines.push(line)
+        }
+        return lines
+      }
+    }
+  } finally {
+    await handle.close()
+  }
+}
+
+function removeFile(catalog: Catalog, fileName: string) {
+  const slug = catalog.slugs[fileName]
+  if (slug === undefined) {
+    return
+  }
+  delete catalog.slugs[fileName]
+  const ownsArticle = catalog.articles[slug]?.fileName === fileName
+  const ownsFile = catalog.files[slug.toLowerCase()] === fileName
+  if (ownsArticle) {
+    delete catalog.articles[slug]
+  }
+  if (ownsFile) {
+    delete catalog.files[slug.toLowerCase()]
+  }
+  if (!ownsArticle && !ownsFile) {
+    return
+  }
+
+  // another file may have the same title, it takes over the slug
+  for (const [other, otherSlug] of Object.entries(catalog.slugs)) {
+    if (ownsArticle && otherSlug === slug && catalog.headers[other]) {
+      const {title} = parseArticleTitle(catalog.headers[other].line)
+      catalog.articles[slug] = {title, fileName: other, slug}
+    }
+    if (ownsFile && otherSlug.toLowerCase() === slug.toLowerCase()) {
+      catalog.files[slug.toLowerCase()] = other
+    }
+  }
+}
+
+function addFile(catalog: Catalog, fileName: string, line: string) {
+  removeFile(catalog, fileName)
+  const {title, slug} = parseArticleTitle(line)
+  const article: Article = {title, fileName, slug}
+  catalog.articles[slug] = article
+  catalog.files[slug.toLowerCase()] = fileName
+  catalog.slugs[fileName] = slug
+}
+
+async function readFile(catalog: Catalog, notesDir: string, fileName: string, saved?: CatalogSnapshot) {
+  const read = (catalog.reads[fileName] || 0) + 1
+  catalog.reads[fileName] = read
+
+  let header: FileHeader | null = null
+  try {
+    const filepath = path.join(notesDir, fileName)
+    const stat = await fs.promises.stat(filepath)
+    const savedHeader = saved?.[fileName]
+    if (savedHeader && savedHeader.mtimeMs === stat.mtimeMs && savedHeader.size === stat.size) {
+      header = savedHeader
+    } else if (stat.isFile()) {
+      header = {mtimeMs: stat.mtimeMs, size: stat.size, line: await readFirstLine(filepath)}
+    }
+  } catch (e) {
+    if (e.code !== 'ENOENT') {
+      logger.error('read article: ', fileName, e)
+    }
+  }
+
+  // a newer event for this file was handled meanwhile
+  if (catalog.reads[fileName] !== read) {
+    return
+  }
+  if (header === null) {
+    removeFile(catalog, fileName)
+    delete catalog.headers[fileName]
+  } else {
+    addFile(catalog, fileName, header.line)
+    catalog.headers[fileName] = header
+  }
+  listeners[notesDir]?.forEach((listener) => listener(fileName))
+}
+
+async function readFiles(catalog: Catalog, notesDir: string, fileNames: string[], saved?: CatalogSnapshot) {
+  let next = 0
+  const worker = async () => {
+    while (next < fileNames.length) {
+      await readFile(catalog, notesDir, fileNames[next++], saved)
+    }
+  }
+  await Promise.all(Array.from({length: Math.min(CONCURRENCY, fileNames.length)}, worker))
+}
+
+// dotfiles aren't articles, e.g. the temporary files of a sync
+const isHidden = (fileName: string) => fileName.startsWith('.')
+
+async function listFiles(notesDir: string) {
+  const items = await fs.promises.readdir(notesDir, {withFileTypes: true})
+  return items.filter((item) => !item.isDirectory() && !isHidden(item.name)).map((item) => item.name)
+}
+
+function watch(catalog: Catalog, notesDir: string) {
+  const onChange = (fileName: string) => {
+    if (isHidden(fileName)) {
+      return
+    }
+    clearTimeout(catalog.timers[fileName])
+    catalog.timers[fileName] = setTimeout(() => {
+      delete catalog.timers[fileName]
+      readFile(catalog, notesDir, fileName)
+    }, WATCH_DELAY)
+  }
+
+  try {
+    catalog.watcher = fs.watch(notesDir, {persistent: false}, (_event, fileName) => {
+      if (fileName) {
+        onChange(fileName.toString())
+      } else {
+        // the platform didn't say which file changed
+        listFiles(notesDir)
+          .then((fileNames) => [...new Set([...fileNames, ...Object.keys(catalog.slugs)])].forEach(onChange))
+          .catch((e) => logger.error('list articles: ', e))
+      }
+    })
+  } catch (e) {
+    logger.error('watch notes dir: ', notesDir, e)
+    return
+  }
+
+  catalog.watcher.on('error', (e) => {
+    // read the directory from scratch on the next call
+    logger.error('watch notes dir: ', notesDir, e)
+    catalog.watcher.close()
+    delete catalogs[notesDir]
+  })
+}
+
+async function buildCatalog(notesDir: string, saved?: CatalogSnapshot): Promise<Catalog> {
+  const catalog: Catalog = {
+    articles: {},
+    headers: {},
+    files: {},
+    slugs: {},
+    reads: {},
+    timers: {},
+    watcher: null,
+  }
+
+  // watch before listing so no change goes unnoticed
+  watch(catalog, notesDir)
+  try {
+    await readFiles(catalog, notesDir, await listFiles(notesDir), saved)
+  } catch (e) {
+    catalog.watcher?.close()
+    throw e
+  }
+  return catalog
+}
+
+function getCatalog(notesDir: string): Promise<Catalog> {
+  if (!catalogs[notesDir]) {
+    catalogs[notesDir] = buildCatalog(notesDir, savedCatalogs[notesDir])
+    delete savedCatalogs[notesDir]
+    catalogs[notesDir].catch(() => {
+      delete catalogs[notesDir]
+    })
+  }
+  return catalogs[notesDir]
+}
+
+/**
+ * Articles of `notesDir` indexed by slug, the returned object is kept current
+ */
+export async function getCatalogArticles(notesDir: string): Promise<Articles> {
+  return (await getCatalog(notesDir)).articles
+}
+
+/**
+ * Path of the article named `articleName`, undefined if there is none
+ */
+export async function findArticleFile(notesDir: string, articleName: string) {
+  const catalog = await getCatalog(notesDir)
+  const fileName = catalog.files[slugifyArticleName(articleName).toLowerCase()]
+  return fileName === undefined ? undefined : path.join(notesDir, fileName)
+}
+
+/**
+ * Article of `notesDir` defined by `fileName`, undefined if there is none
+ */
+export async function findFileArticle(notesDir: string, fileName: string) {
+  const catalog = await getCatalog(notesDir)
+  const slug = catalog.slugs[fileName]
+  const article = slug === undefined ? undefined : catalog.articles[slug]
+  return article?.fileName === fileName ? article : undefined
+}
+
+/**
+ * Read `fileNames` of `notesDir` again now, for changes the watcher may not
+ * report or not report in time
+ */
+export async function refreshArticles(notesDir: string, fileNames: string[]) {
+  if (catalogs[notesDir]) {
+    await readFiles(await catalogs[notesDir], notesDir, fileNames)
+  }
+}
+
+/**
+ * Call `listener` with the name of each file of `notesDir` read again
+ */
+export function watchArticles(notesDir: string, listener: (fileName: string) => void) {
+  if (!listeners[notesDir]) {
+    listeners[notesDir] = new Set()
+  }
+  listeners[notesDir].add(listener)
+  return () => listeners[notesDir].delete(listener)
+}
+
+/**
+ * Headers of the files of `notesDir` to save, null if it wasn't read
+ */
+export async function snapshotCatalog(notesDir: string): Promise<CatalogSnapshot | null> {
+  return catalogs[notesDir] ? (await catalogs[notesDir]).headers : null
+}
+
+/**
+ * Reuse the saved first lines of files whose mtime and size didn't change
+ * when `notesDir` is read
+ */
+export function restoreCatalog(notesDir: string, saved: CatalogSnapshot) {
+  if (!catalogs[notesDir]) {
+    savedCatalogs[notesDir] = saved
+  }
+}
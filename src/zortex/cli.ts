@@ -1,8 +1,11 @@
 import * as path from 'path'
 import {Env} from './types'
-import {indexCategories, populateHub, indexZettels} from './zettel'
-import {inspect, readLines, allRelatedTags} from './helpers'
+import {indexCategories, populateHub} from './zettel'
+import {getZettels} from './store'
+import {loadSnapshot, saveSnapshot} from './snapshot'
+import {inspect, readLines, allRelatedTags, missingTags} from './helpers'
 import {executeCommand, repl} from './repl'
+import {serveSocket, serveStream} from './batch'
 import {getArticleStructures} from './structures'
 
 function parseArgs(args: string[]) {
@@ -10,6 +13,8 @@ function parseArgs(args: string[]) {
     onlyTags: false,
     relatedTags: false,
     repl: false,
+    batch: false,
+    socket: null,
     missingTags: false,
     structures: false,
     command: null,
@@ -64,6 +69,12 @@ function parseArgs(args: string[]) {
       case '--repl':
         env.repl = true
         break
+      case '--batch':
+        env.batch = true
+        break
+      case '--socket':
+        env.socket = nextArg()
+        break
       case '--related-tags':
         env.relatedTags = true
         break
@@ -92,7 +103,12 @@ async function setupEnv(env: Env): Promise<Env> {
   resolveFile('noteFile')
 
   if (env.zettelsFile) {
-    env.zettels = await indexZettels(env.zettelsFile)
+    // parse the zettels only if they changed since the last snapshot
+    const restored = await loadSnapshot(env.projectDir, env.extension, env.zettelsFile)
+    env.zettels = await getZettels(env.zettelsFile)
+    if (!restored) {
+      await saveSnapshot(env.projectDir, env.extension, env.zettelsFile)
+    }
   }
 
   return env
@@ -111,29 +127,21 @@ export async function run() {
     return repl(env)
   }
 
+  // JSON lines requests, answered from the same index
+  if (env.socket) {
+    return serveSocket(env, path.resolve(env.socket))
+  }
+  if (env.batch) {
+    return serveStream(env, process.stdin, process.stdout)
+  }
+
   // Show related tags
   if (env.relatedTags) {
     return inspect(allRelatedTags(env.zettels))
   }
 
   if (env.missingTags) {
-    const hubTags: Set<string> = new Set()
-    const lines = readLines(env.noteFile)
-    const tagRE = /- ([a-z0-9][a-z0-9=-]*)/
-    const zettelIdRE = /z:[0-9.]+/
-    for await (const line of lines) {
-      const match = line.match(tagRE)
-      if (!match) {
-        continue
-      }
-      hubTags.add(match[1])
-    }
-    const missingTags = [...Object.keys(env.zettels.tags)]
-      .filter((tag) => {
-        return !hubTags.has(tag) && !zettelIdRE.test(tag)
-      })
-      .sort()
-    console.log(missingTags)
+    console.log(await missingTags(env.zettels, env.noteFile))
     return
   }
 
@@ -4,6 +4,7 @@ import * as path from 'path'
 import * as readline from 'readline'
 import {Zettels} from './types'
 import {compareArticle, parseArticleTitle, compareArticleSlugs, slugifyArticleName} from './wiki'
+import {findArticleFile} from './catalog'
 
 export function inspect(x: any) {
   console.log(
@@ -40,64 +41,83 @@ export function readLines(filename: string): readline.Interface {
   return lines
 }
 
-export function relatedTags(zettels: Zettels, tag: string): string[] {
-  const relatedTags = new Set<string>()
-  zettels.tags[tag]?.forEach((id) => {
-    const zettel = zettels.ids[id]
-    zettel.tags.forEach((t: string) => {
-      if (t !== tag) {
-        relatedTags.add(t)
+export interface RelatedTag {
+  tag: string
+  // number of zettels with both tags
+  count: number
+}
+
+// Co-occurrence counts of `zettels`, counted here for zettels not indexed by the store
+function getRelated(zettels: Zettels) {
+  if (!zettels.related) {
+    const related: Zettels['related'] = {}
+    for (const zettel of Object.values(zettels.ids)) {
+      for (const tag of zettel.tags) {
+        for (const other of zettel.tags) {
+          if (tag !== other) {
+            related[tag] = related[tag] || new Map()
+            related[tag].set(other, (related[tag].get(other) || 0) + 1)
+          }
+        }
       }
-    })
-  })
+    }
+    zettels.related = related
+  }
+  return zettels.related
+}
 
-  return [...relatedTags]
+/**
+ * Tags sharing zettels with `tag`, most shared first
+ */
+export function weightedRelatedTags(zettels: Zettels, tag: string, limit = Infinity): RelatedTag[] {
+  const counts = getRelated(zettels)[tag]
+  if (!counts) {
+    return []
+  }
+  return [...counts]
+    .map(([other, count]) => ({tag: other, count}))
+    .sort((a, b) => b.count - a.count || (a.tag < b.tag ? -1 : 1))
+    .slice(0, limit)
+}
+
+export function relatedTags(zettels: Zettels, tag: string): string[] {
+  return weightedRelatedTags(zettels, tag).map((related) => related.tag)
 }
 
 /**
- * Return which tags each tag is associated with
+ * Return which tags each tag is associated with, most shared first
  */
-export function allRelatedTags(zettels: Zettels) {
-  let tags = Object.keys(zettels.tags).reduce((acc, tag) => {
-    acc[tag] = new Set()
+export function allRelatedTags(zettels: Zettels): {[tag: string]: RelatedTag[]} {
+  return Object.keys(zettels.tags).reduce((acc, tag) => {
+    acc[tag] = weightedRelatedTags(zettels, tag)
     return acc
   }, {})
+}
 
-  // For each tag, add all tags that are associated with it
-  for (const zettel of Object.values(zettels.ids)) {
-    for (const tag of zettel.tags) {
-      zettel.tags.forEach(tags[tag].add, tags[tag])
+/**
+ * Tags of `zettels` missing from the `- tag` list items of the note at `noteFile`
+ */
+export async function missingTags(zettels: Zettels, noteFile: string): Promise<string[]> {
+  const hubTags: Set<string> = new Set()
+  const tagRE = /- ([a-z0-9][a-z0-9=-]*)/
+  const zettelIdRE = /z:[0-9.]+/
+  for await (const line of readLines(noteFile)) {
+    const match = line.match(tagRE)
+    if (match) {
+      hubTags.add(match[1])
     }
   }
-
-  // Convert tags to array
-  for (const tag of Object.keys(tags)) {
-    tags[tag] = [...tags[tag]]
-  }
-  return tags
+  return Object.keys(zettels.tags)
+    .filter((tag) => !hubTags.has(tag) && !zettelIdRE.test(tag))
+    .sort()
 }
 
 export function toSpacecase(str: string) {
   return str.charAt(0).toUpperCase() + str.slice(1).replace(/-/g, ' ')
 }
 
-export async function getArticleFilepath(notesDir: string, articleName: string) {
-  const articleSlug = slugifyArticleName(articleName)
-
-  // get article files
-  const fileNames = fs
-    .readdirSync(notesDir, {withFileTypes: true})
-    .filter((item) => !item.isDirectory())
-    .map((item) => item.name)
-
-  for await (const fileName of fileNames) {
-    const filepath = path.join(notesDir, fileName)
-    const line = await getFirstLine(filepath)
-    const {slug} = parseArticleTitle(line)
-    if (compareArticleSlugs(slug, articleSlug)) {
-      return filepath
-    }
-  }
+export function getArticleFilepath(notesDir: string, articleName: string) {
+  return findArticleFile(notesDir, articleName)
 }
 
 export async function getArticleTitle(filepath) {
@@ -0,0 +1,135 @@
+import * as fs from 'fs'
+import {Zettels} from './types'
+import {isQuery, parseQuery} from './query'
+import {populateHub} from './zettel'
+import {watchZettels, ZettelsChange} from './store'
+
+/*
+ * Populated articles kept in memory.
+ *
+ * An entry stays valid while its file is unchanged and no zettel with one of
+ * the tags its queries mention was added, removed or edited.
+ */
+
+interface Hub {
+  mtimeMs: number
+  size: number
+  // tags the queries depend on
+  dependencies: Set<string>
+  content: string[]
+}
+
+interface HubCache {
+  hubs: Map<string, Hub>
+  // hubs depending on each tag
+  dependents: Map<string, Set<string>>
+  // bumped by each zettels change, to drop hubs populated meanwhile
+  generation: number
+}
+
+const caches: {[zettelsFile: string]: HubCache} = {}
+
+function removeHub(cache: HubCache, filepath: string) {
+  const hub = cache.hubs.get(filepath)
+  if (!hub) {
+    return
+  }
+  hub.dependencies.forEach((tag) => {
+    const dependents = cache.dependents.get(tag)
+    dependents.delete(filepath)
+    if (dependents.size === 0) {
+      cache.dependents.delete(tag)
+    }
+  })
+  cache.hubs.delete(filepath)
+}
+
+function addHub(cache: HubCache, filepath: string, hub: Hub) {
+  removeHub(cache, filepath)
+  cache.hubs.set(filepath, hub)
+  hub.dependencies.forEach((tag) => {
+    if (!cache.dependents.has(tag)) {
+      cache.dependents.set(tag, new Set())
+    }
+    cache.dependents.get(tag).add(filepath)
+  })
+}
+
+function invalidate(cache: HubCache, change: ZettelsChange) {
+  cache.generation++
+  if (!change) {
+    cache.hubs.clear()
+    cache.dependents.clear()
+    return
+  }
+
+  const filepaths = new Set<string>()
+  for (const tag of change.tags) {
+    cache.dependents.get(tag)?.forEach((filepath) => filepaths.add(filepath))
+  }
+  filepaths.forEach((filepath) => removeHub(cache, filepath))
+}
+
+/**
+ * Tags the queries of `lines` depend on
+ */
+function hubDependencies(lines: string[]): Set<string> {
+  const tags = new Set<string>()
+  for (const line of lines) {
+    const query = isQuery(line) && parseQuery(line)
+    if (!query) {
+      continue
+    }
+    // negations alone match nothing whatever the zettels
+    if (query.clauses.every((clause) => clause.negate)) {
+      continue
+    }
+    query.tags.forEach((tag) => tags.add(tag))
+  }
+  return tags
+}
+
+function getCache(zettelsFile: string) {
+  if (!caches[zettelsFile]) {
+    const cache: HubCache = caches[zettelsFile] = {
+      hubs: new Map(),
+      dependents: new Map(),
+      generation: 0,
+    }
+    watchZettels(zettelsFile, (change) => invalidate(cache, change))
+  }
+  return caches[zettelsFile]
+}
+
+/**
+ * Populated lines of the article at `filepath`, from memory when neither the
+ * article nor the zettels it queries changed. `zettels` must come from the
+ * store for `zettelsFile`.
+ */
+export async function getPopulatedArticle(
+  filepath: string,
+  zettelsFile: string,
+  zettels: Zettels,
+  notesDir: string
+): Promise<string[]> {
+  const cache = getCache(zettelsFile)
+  const stat = await fs.promises.stat(filepath)
+  const cached = cache.hubs.get(filepath)
+  if (cached && cached.mtimeMs === stat.mtimeMs && cached.size === stat.size) {
+    return cached.content
+  }
+
+  const generation = cache.generation
+  const lines = (await fs.promises.readFile(filepath)).toString().split('\n')
+  const content = await populateHub(lines, zettels, notesDir)
+  if (cache.generation !== generation) {
+    return content
+  }
+  addHub(cache, filepath, {
+    mtimeMs: stat.mtimeMs,
+    size: stat.size,
+    dependencies: hubDependencies(lines),
+    content,
+  })
+  return content
+}
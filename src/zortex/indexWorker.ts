@@ -0,0 +1,15 @@
+import {parentPort} from 'worker_threads'
+import {indexSource} from './store'
+
+/*
+ * Worker thread parsing zettels files for the store, see workers.ts
+ */
+
+parentPort.on('message', ({id, source}: {id: number; source: Uint8Array}) => {
+  try {
+    const {entries, zettels} = indexSource(Buffer.from(source.buffer, source.byteOffset, source.byteLength))
+    parentPort.postMessage({id, entries, zettels})
+  } catch (e) {
+    parentPort.postMessage({id, error: e.message})
+  }
+})
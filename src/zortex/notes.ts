@@ -0,0 +1,215 @@
+import * as fs from 'fs'
+import * as path from 'path'
+
+const logger = require('../util/logger')('zortex/notes') // tslint:disable-line
+
+/*
+ * Notes of a notes directory as listed by the fzf search, kept in memory.
+ * Each listing stats the directory and only reads files whose mtime or size
+ * changed since the previous one.
+ */
+
+export interface NoteTag {
+  num: number
+  text: string
+}
+
+export interface Note {
+  fileName: string
+  mtimeMs: number
+  size: number
+  // `@` and `@@` tags of the header, most `@` first
+  tags: NoteTag[]
+  // YYYY-WW-D HH:MM:SS from the file name
+  created: string
+  // fzf line: creation time, header tags and an excerpt, as bin/zettel.py writes it
+  line: string
+}
+
+export type SourceType = 'unique' | 'single-tag' | undefined
+
+// number of files stat'ed or read at the same time
+const CONCURRENCY = 32
+
+const tagRE = /^(@+)(.*)$/
+
+// body lines and characters of the fzf line excerpt
+const EXCERPT_LINES = 3
+const EXCERPT_LENGTH = 200
+
+// fileName -> note, per notes directory
+const caches: {[notesDir: string]: Map<string, Note>} = {}
+// refresh in progress, shared by concurrent listings
+const refreshes: {[notesDir: string]: Promise<Map<string, Note>>} = {}
+
+export function noteCreation(fileName: string, extension: string) {
+  if (/^\d{13}/.test(fileName)) {
+    const [year, week, day, hours, minutes, seconds] = [[0, 4], [4, 6], [6, 7], [7, 9], [9, 11], [11, 13]].map(
+      ([start, end]) => fileName.slice(start, end)
+    )
+    return `${year}-${week}-${day} ${hours}:${minutes}:${seconds}`
+  }
+  return fileName.replace(extension, '').padEnd(18)
+}
+
+export function noteTags(lines: string[]): NoteTag[] {
+  const tags: NoteTag[] = []
+  for (const line of lines) {
+    if (line.length === 0) {
+      continue
+    }
+    const match = line.match(tagRE)
+    if (!match) {
+      break
+    }
+    tags.push({num: match[1].length, text: match[2]})
+  }
+  if (tags.length === 0) {
+    return [{num: 0, text: 'Untitled'}]
+  }
+  // sort is stable, tags with the same number keep their order
+  return tags.sort((a, b) => b.num - a.num)
+}
+
+/**
+ * Header tag lines and the first few lines of the body, the preview reads the
+ * rest of the file when it is shown
+ */
+export function noteExcerpt(lines: string[]): string[] {
+  const header: string[] = []
+  let body: string[] = []
+  for (let i = 0; i < lines.length; i++) {
+    if (lines[i].length === 0) {
+      continue
+    }
+    if (!tagRE.test(lines[i])) {
+      body = lines
+        .slice(i)
+        .map((line) => line.trim())
+        .filter((line) => line.length > 0)
+        .slice(0, EXCERPT_LINES)
+      break
+    }
+    header.push(lines[i])
+  }
+
+  const excerpt = body.join(' ').slice(0, EXCERPT_LENGTH)
+  return excerpt ? [...header, excerpt] : header
+}
+
+function parseNote(fileName: string, extension: string, content: string) {
+  const lines = content.split('\n').map((line) => line.replace(/\s+$/, ''))
+  // like readlines, a final line ending doesn't start a line
+  if (content.endsWith('\n')) {
+    lines.pop()
+  }
+  const tags = noteTags(lines)
+  const created = noteCreation(fileName, extension)
+  const lineFields = fileName.endsWith('storage' + extension) ? lines.slice(0, 2) : noteExcerpt(lines)
+  const line = [created + ' ', ...lineFields].join(' \f')
+  return {tags, created, line}
+}
+
+async function eachLimit<T>(items: T[], fn: (item: T) => Promise<void>) {
+  let next = 0
+  const worker = async () => {
+    while (next < items.length) {
+      await fn(items[next++])
+    }
+  }
+  await Promise.all(Array.from({length: Math.min(CONCURRENCY, items.length)}, worker))
+}
+
+async function refresh(notesDir: string, extension: string) {
+  const cache = caches[notesDir] || (caches[notesDir] = new Map())
+  const items = await fs.promises.readdir(notesDir, {withFileTypes: true})
+  const fileNames = new Set(
+    items.filter((item) => !item.isDirectory() && item.name.endsWith(extension)).map((item) => item.name)
+  )
+  for (const fileName of cache.keys()) {
+    if (!fileNames.has(fileName)) {
+      cache.delete(fileName)
+    }
+  }
+
+  await eachLimit([...fileNames], async (fileName) => {
+    const filepath = path.join(notesDir, fileName)
+    try {
+      const stat = await fs.promises.stat(filepath)
+      const cached = cache.get(fileName)
+      if (cached && cached.mtimeMs === stat.mtimeMs && cached.size === stat.size) {
+        return
+      }
+      const content = (await fs.promises.readFile(filepath)).toString()
+      cache.set(fileName, {fileName, mtimeMs: stat.mtimeMs, size: stat.size, ...parseNote(fileName, extension, content)})
+    } catch (e) {
+      cache.delete(fileName)
+      if (e.code !== 'ENOENT') {
+        logger.error('read note: ', fileName, e)
+      }
+    }
+  })
+  return cache
+}
+
+/**
+ * Notes of `notesDir`, current as of the call
+ */
+export function getNotes(notesDir: string, extension: string): Promise<Map<string, Note>> {
+  if (!refreshes[notesDir]) {
+    refreshes[notesDir] = refresh(notesDir, extension).finally(() => {
+      delete refreshes[notesDir]
+    })
+  }
+  return refreshes[notesDir]
+}
+
+export function snapshotNotes(notesDir: string): Note[] | null {
+  return caches[notesDir] ? [...caches[notesDir].values()] : null
+}
+
+/**
+ * Start from saved notes, the next listing reads those which changed since
+ */
+export function restoreNotes(notesDir: string, notes: Note[]) {
+  if (!caches[notesDir]) {
+    caches[notesDir] = new Map(notes.map((note) => [note.fileName, note]))
+  }
+}
+
+// reverse order of (is a @@[name](link), lower case tag, number of tags),
+// fzf lists the input from the last line on
+function compareNotes(a: Note, b: Note) {
+  const keyA = a.tags[0].text
+  const keyB = b.tags[0].text
+  const linkA = keyA.startsWith('[')
+  const linkB = keyB.startsWith('[')
+  if (linkA !== linkB) {
+    return linkA ? -1 : 1
+  }
+  const lowerA = keyA.toLowerCase()
+  const lowerB = keyB.toLowerCase()
+  if (lowerA !== lowerB) {
+    return lowerA < lowerB ? 1 : -1
+  }
+  return b.tags.length - a.tags.length
+}
+
+/**
+ * Notes in the order fzf lists them, filtered by `type` as source.py does
+ */
+export function sourceNotes(notes: Iterable<Note>, type: SourceType): Note[] {
+  let sorted = [...notes]
+  if (type === 'single-tag') {
+    sorted = sorted.filter((note) => note.tags.length <= 1)
+  }
+  sorted.sort(compareNotes)
+
+  if (type === 'unique') {
+    // keeps the position of the first note of each tag, and the last note
+    const unique = new Map<string, Note>()
+    sorted.forEach((note) => unique.set(note.tags[0].text, note))
+    sorted = [...unique.values()]
+  }
+  return sorted
+}
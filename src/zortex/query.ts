@@ -1,4 +1,5 @@
-import {Query, Zettels} from './types'
+import {Query, QueryClause, Zettels} from './types'
+import type {ZettelsChange} from './store'
 
 // % #asdf#asdfa#
 const queryRE = /^(\s*)%\s*#(.*)#$/
@@ -8,6 +9,10 @@ export function isQuery(line: string): boolean {
   return isQueryRE.test(line)
 }
 
+/**
+ * Parse `% #a#b|c#-d#`: zettels tagged a, either b or c, and not d. Negations
+ * only narrow the other clauses, a query made only of them matches nothing.
+ */
 export function parseQuery(queryString: string): Query {
   const match = queryString.match(queryRE)
   if (!match) {
@@ -16,34 +21,338 @@ export function parseQuery(queryString: string): Query {
   const indent = match[1].length
   const query = match[2].trim()
 
-  let tags: string[]
-  tags = query.split('#').filter((v) => v)
+  const clauses: QueryClause[] = query
+    .split('#')
+    .filter((v) => v)
+    .map((term) => {
+      const negate = term.startsWith('-')
+      const tags = (negate ? term.slice(1) : term).split('|').filter((v) => v)
+      return {tags, negate}
+    })
+    .filter((clause) => clause.tags.length > 0)
 
   return {
     indent,
-    tags,
+    tags: [...new Set(clauses.flatMap((clause) => clause.tags))],
+    clauses,
   }
 }
 
-export function fetchQuery(query: Query, zettels: Zettels) {
-  // Remove tags that aren't found in zettels
-  const queryTags = query.tags.filter((tag) => zettels.tags[tag])
-  if (queryTags.length === 0) {
+/*
+ * Queries run on sorted posting lists of zettel numbers. Zettels are
+ * numbered in file order, and shard order for sharded zettels, so results
+ * keep the order of the zettels files.
+ *
+ * Numbers are kept across the updates of the store: removed zettels leave a
+ * hole, appended ones take the next numbers, and only the posting lists and
+ * results of the tags an update touched are dropped. Zettels are numbered
+ * again when they were indexed from scratch, when an update moved or
+ * inserted zettels before others, or once most numbers are holes.
+ */
+
+interface Engine {
+  version: number
+  // number -> id, null for zettels removed since they were numbered
+  ids: string[]
+  numbers: {[id: string]: number}
+  holes: number
+  postings: {[tag: string]: Uint32Array}
+  // normalized query -> tags it mentions and its result
+  results: Map<string, {tags: string[]; ids: string[]}>
+}
+
+// posting lists saved to disk
+export interface PostingsSnapshot {
+  version: number
+  ids: string[]
+  postings: {[tag: string]: Uint32Array}
+}
+
+// most cached query results per zettels
+const MAX_CACHED_RESULTS = 1024
+
+const engines = new WeakMap<Zettels, Engine>()
+
+const compareShards = (a: string = '', b: string = '') => (a < b ? -1 : a > b ? 1 : 0)
+
+// order of two zettels in the zettels files
+function compareZettels(zettels: Zettels, a: string, b: string) {
+  return (
+    compareShards(zettels.ids[a].shard, zettels.ids[b].shard) ||
+    zettels.ids[a].lineNumber - zettels.ids[b].lineNumber
+  )
+}
+
+function createEngine(version: number, ids: string[], postings: Engine['postings']): Engine {
+  const numbers = {}
+  let holes = 0
+  ids.forEach((id, i) => (id === null ? holes++ : (numbers[id] = i)))
+  return {version, ids, numbers, holes, postings, results: new Map()}
+}
+
+function getEngine(zettels: Zettels): Engine {
+  const version = zettels.version || 0
+  let engine = engines.get(zettels)
+  if (engine && engine.version === version) {
+    return engine
+  }
+
+  const ids = Object.keys(zettels.ids).sort((a, b) => compareZettels(zettels, a, b))
+  engine = createEngine(version, ids, {})
+  engines.set(zettels, engine)
+  return engine
+}
+
+// nearest id numbered before (step -1) or after (step 1) `n`, null if none
+function neighbour(engine: Engine, n: number, step: 1 | -1) {
+  for (let i = n + step; i >= 0 && i < engine.ids.length; i += step) {
+    if (engine.ids[i] !== null) {
+      return engine.ids[i]
+    }
+  }
+  return null
+}
+
+// number the zettels of `change`, false if they can't keep file order
+function renumber(engine: Engine, zettels: Zettels, change: ZettelsChange) {
+  for (const id of change.removed) {
+    const n = engine.numbers[id]
+    if (n !== undefined && !zettels.ids[id]) {
+      engine.ids[n] = null
+      delete engine.numbers[id]
+      engine.holes++
+    }
+  }
+
+  const added: string[] = []
+  for (const id of change.added) {
+    const n = engine.numbers[id]
+    if (n === undefined) {
+      added.push(id)
+      continue
+    }
+    // parsed again in place, it must still be between its neighbours
+    const before = neighbour(engine, n, -1)
+    const after = neighbour(engine, n, 1)
+    if (
+      (before !== null && compareZettels(zettels, before, id) > 0) ||
+      (after !== null && compareZettels(zettels, id, after) > 0)
+    ) {
+      return false
+    }
+  }
+
+  added.sort((a, b) => compareZettels(zettels, a, b))
+  const last = neighbour(engine, engine.ids.length, -1)
+  if (added.length > 0 && last !== null && compareZettels(zettels, last, added[0]) > 0) {
+    return false
+  }
+  for (const id of added) {
+    engine.numbers[id] = engine.ids.length
+    engine.ids.push(id)
+  }
+  return engine.holes <= engine.ids.length / 2
+}
+
+/**
+ * Apply to the query engine of `zettels` the change of the update which just
+ * bumped its version
+ */
+export function updatePostings(zettels: Zettels, change: ZettelsChange) {
+  const engine = engines.get(zettels)
+  if (!engine || engine.version !== (zettels.version || 0) - 1) {
+    return
+  }
+  if (!change || !renumber(engine, zettels, change)) {
+    engines.delete(zettels)
+    return
+  }
+
+  engine.version = zettels.version
+  const tags = new Set(change.tags)
+  tags.forEach((tag) => delete engine.postings[tag])
+  for (const [key, result] of engine.results) {
+    if (result.tags.some((tag) => tags.has(tag))) {
+      engine.results.delete(key)
+    }
+  }
+}
+
+/**
+ * Posting lists built for `zettels` to save, null if there are none
+ */
+export function snapshotPostings(zettels: Zettels): PostingsSnapshot | null {
+  const engine = engines.get(zettels)
+  if (!engine || engine.version !== (zettels.version || 0)) {
+    return null
+  }
+  return {version: engine.version, ids: engine.ids, postings: engine.postings}
+}
+
+/**
+ * Use saved posting lists for `zettels` if they were built for its version,
+ * or for the same ids in the same order, as for zettels merged again from
+ * restored shards
+ */
+export function restorePostings(zettels: Zettels, snapshot: PostingsSnapshot) {
+  const engine = engines.get(zettels)
+  if (engine && Object.keys(engine.postings).length > 0) {
+    return
+  }
+  if (!engine && snapshot.version === (zettels.version || 0)) {
+    engines.set(zettels, createEngine(snapshot.version, snapshot.ids, snapshot.postings))
+    return
+  }
+  const current = getEngine(zettels)
+  if (current.ids.length === snapshot.ids.length && current.ids.every((id, i) => id === snapshot.ids[i])) {
+    current.postings = snapshot.postings
+  }
+}
+
+function posting(engine: Engine, zettels: Zettels, tag: string): Uint32Array {
+  if (!engine.postings[tag]) {
+    const list = new Uint32Array(zettels.tags[tag]?.size || 0)
+    let i = 0
+    zettels.tags[tag]?.forEach((id) => (list[i++] = engine.numbers[id]))
+    engine.postings[tag] = list.sort()
+  }
+  return engine.postings[tag]
+}
+
+/**
+ * Index of the first element of `list` not less than `value`, from `lo` on
+ */
+function gallop(list: Uint32Array, value: number, lo: number) {
+  let step = 1
+  let hi = lo
+  while (hi < list.length && list[hi] < value) {
+    lo = hi + 1
+    hi += step
+    step *= 2
+  }
+  hi = Math.min(hi, list.length)
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1
+    if (list[mid] < value) {
+      lo = mid + 1
+    } else {
+      hi = mid
+    }
+  }
+  return lo
+}
+
+function intersect(a: Uint32Array, b: Uint32Array) {
+  if (a.length > b.length) {
+    ;[a, b] = [b, a]
+  }
+  const result = new Uint32Array(a.length)
+  let length = 0
+  let j = 0
+  for (let i = 0; i < a.length && j < b.length; i++) {
+    j = gallop(b, a[i], j)
+    if (b[j] === a[i]) {
+      result[length++] = a[i]
+    }
+  }
+  return result.subarray(0, length)
+}
+
+function subtract(a: Uint32Array, b: Uint32Array) {
+  const result = new Uint32Array(a.length)
+  let length = 0
+  let j = 0
+  for (let i = 0; i < a.length; i++) {
+    j = gallop(b, a[i], j)
+    if (b[j] !== a[i]) {
+      result[length++] = a[i]
+    }
+  }
+  return result.subarray(0, length)
+}
+
+function union(a: Uint32Array, b: Uint32Array) {
+  const result = new Uint32Array(a.length + b.length)
+  let length = 0
+  let i = 0
+  let j = 0
+  while (i < a.length && j < b.length) {
+    if (a[i] < b[j]) {
+      result[length++] = a[i++]
+    } else if (a[i] > b[j]) {
+      result[length++] = b[j++]
+    } else {
+      result[length++] = a[i++]
+      j++
+    }
+  }
+  while (i < a.length) {
+    result[length++] = a[i++]
+  }
+  while (j < b.length) {
+    result[length++] = b[j++]
+  }
+  return result.subarray(0, length)
+}
+
+function unionAll(lists: Uint32Array[]) {
+  // merge the shortest lists first
+  const queue = lists.slice().sort((a, b) => a.length - b.length)
+  while (queue.length > 1) {
+    queue.push(union(queue.shift(), queue.shift()))
+    queue.sort((a, b) => a.length - b.length)
+  }
+  return queue[0]
+}
+
+function normalizeQuery(query: Query) {
+  return query.clauses
+    .map((clause) => (clause.negate ? '-' : '') + [...new Set(clause.tags)].sort().join('|'))
+    .sort()
+    .join('#')
+}
+
+function runQuery(engine: Engine, zettels: Zettels, query: Query): string[] {
+  const positive = query.clauses.filter((clause) => !clause.negate)
+  const negative = query.clauses.filter((clause) => clause.negate)
+
+  // Tags that aren't found in zettels don't restrict the query
+  const clauseList = (clause: QueryClause) =>
+    unionAll(clause.tags.filter((tag) => zettels.tags[tag]).map((tag) => posting(engine, zettels, tag)))
+  const lists = positive
+    .filter((clause) => clause.tags.some((tag) => zettels.tags[tag]))
+    .map(clauseList)
+    .sort((a, b) => a.length - b.length)
+
+  if (lists.length === 0) {
     return []
   }
 
-  // Get the tag with smallest number of zettels
-  let smallestTag = queryTags[0]
-  for (const tag of queryTags) {
-    if (zettels.tags[tag].size < zettels.tags[smallestTag].size) {
-      smallestTag = tag
+  let result = lists.reduce(intersect)
+
+  for (const clause of negative) {
+    if (clause.tags.some((tag) => zettels.tags[tag])) {
+      result = subtract(result, clauseList(clause))
     }
   }
 
-  // Keep only zettels which have all tags
-  const zettelsWithTags = [...zettels.tags[smallestTag]].filter((id) => {
-    return queryTags.every((tag) => zettels.tags[tag].has(id))
-  })
-  return zettelsWithTags
+  return Array.from(result, (n) => engine.ids[n])
 }
 
+export function fetchQuery(query: Query, zettels: Zettels): string[] {
+  if (!query) {
+    return []
+  }
+
+  const engine = getEngine(zettels)
+  const key = normalizeQuery(query)
+  let result = engine.results.get(key)
+  if (!result) {
+    result = {tags: query.tags, ids: runQuery(engine, zettels, query)}
+    if (engine.results.size >= MAX_CACHED_RESULTS) {
+      engine.results.clear()
+    }
+    engine.results.set(key, result)
+  }
+  return result.ids
+}
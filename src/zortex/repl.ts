@@ -5,7 +5,7 @@ import * as fs from 'fs'
 import { Env } from './types'
 import { indexArticles, indexCategories, showZettels } from './zettel'
 import { parseQuery, fetchQuery } from './query'
-import { inspect, readLines, toSpacecase, relatedTags } from './helpers'
+import { inspect, readLines, toSpacecase, relatedTags, weightedRelatedTags } from './helpers'
 
 export async function executeCommand(input: string, loop, env: Env, rl) {
   const [command, ...args] = input.split(' ')
@@ -175,7 +175,7 @@ export async function executeCommand(input: string, loop, env: Env, rl) {
 
   if (command === 'related-tags') {
     for (const arg of args) {
-      const related = relatedTags(env.zettels, arg).sort()
+      const related = weightedRelatedTags(env.zettels, arg).map(({tag, count}) => `${tag}(${count})`)
       console.log(`\x1b[36m${arg}: \x1b[0m${related.join(' ')}`)
     }
     return loop()
@@ -222,5 +222,9 @@ export async function repl(env: Env) {
   })
   // env.categoriesGraph = await indexCategories(env.categoriesFile)
 
+  // read article headers while waiting for the first command, later
+  // commands only read the headers which changed
+  indexArticles(env.projectDir).catch(() => {})
+
   return replLoop(env, rl, [])
 }
@@ -0,0 +1,375 @@
+import * as fs from 'fs'
+import * as path from 'path'
+import {Zettels} from './types'
+import {getZettels, watchZettels, ZettelsChange} from './store'
+import {findFileArticle, getCatalogArticles, watchArticles} from './catalog'
+import {Article} from './wiki'
+
+const logger = require('../util/logger')('zortex/search') // tslint:disable-line
+
+/*
+ * Inverted index over article bodies and zettels.
+ *
+ * Each term maps to the documents containing it and the term frequency.
+ * Documents are scored with BM25 and a query matches documents containing
+ * every term, the last term also matching as a prefix while it's typed.
+ * The index follows the article catalog and zettels store, re-indexing
+ * only the files and zettels they report as changed.
+ */
+
+export type SearchResult =
+  | {type: 'article'; title: string; slug: string; fileName: string; score: number}
+  | {type: 'zettel'; id: string; title: string; tags: string[]; score: number}
+
+interface Doc {
+  key: string
+  type: 'article' | 'zettel'
+  // file name of an article or id of a zettel
+  ref: string
+  length: number
+  terms: Map<string, number>
+}
+
+interface SearchIndex {
+  docs: Map<string, Doc>
+  postings: Map<string, Map<string, number>>
+  // sorted terms for prefix matching, may still contain removed terms
+  terms: string[]
+  newTerms: Set<string>
+  totalLength: number
+  zettelsFile: string
+  // files reported by the catalog since the last sync
+  dirtyFiles: Set<string>
+  // zettels reported by the store since the last sync
+  zettelChanges: ZettelsChange[]
+  // index every article on the next sync
+  scan: boolean
+  syncing: Promise<void> | null
+}
+
+const BM25_K1 = 1.2
+const BM25_B = 0.75
+// article titles count as this many occurrences of their terms
+const TITLE_WEIGHT = 3
+// most terms a prefix expands to
+const MAX_PREFIX_TERMS = 64
+// re-sort the terms instead of inserting when more are new
+const MAX_TERM_INSERTS = 1024
+const SNIPPET_LENGTH = 120
+
+const indexes: {[zettelsFile: string]: SearchIndex} = {}
+
+export function tokenize(text: string): string[] {
+  return text.toLowerCase().match(/[a-z0-9\u00c0-\u1fff\u2070-\uffff]+/g) || []
+}
+
+function countTerms(terms: Map<string, number>, text: string, weight = 1) {
+  let length = 0
+  for (const term of tokenize(text)) {
+    terms.set(term, (terms.get(term) || 0) + weight)
+    length += weight
+  }
+  return length
+}
+
+function sortedIndex(terms: string[], term: string) {
+  let lo = 0
+  let hi = terms.length
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1
+    if (terms[mid] < term) {
+      lo = mid + 1
+    } else {
+      hi = mid
+    }
+  }
+  return lo
+}
+
+function removeDoc(index: SearchIndex, key: string) {
+  const doc = index.docs.get(key)
+  if (!doc) {
+    return
+  }
+  for (const term of doc.terms.keys()) {
+    const posting = index.postings.get(term)
+    posting.delete(key)
+    if (posting.size === 0) {
+      index.postings.delete(term)
+      index.newTerms.delete(term)
+    }
+  }
+  index.totalLength -= doc.length
+  index.docs.delete(key)
+}
+
+function addDoc(index: SearchIndex, doc: Doc) {
+  removeDoc(index, doc.key)
+  for (const [term, tf] of doc.terms) {
+    let posting = index.postings.get(term)
+    if (!posting) {
+      posting = new Map()
+      index.postings.set(term, posting)
+      index.newTerms.add(term)
+    }
+    posting.set(doc.key, tf)
+  }
+  index.totalLength += doc.length
+  index.docs.set(doc.key, doc)
+}
+
+function zettelDoc(id: string, zettels: Zettels): Doc {
+  const zettel = zettels.ids[id]
+  const terms = new Map<string, number>()
+  let length = countTerms(terms, [...zettel.tags].join(' '))
+  const content = Array.isArray(zettel.content) ? zettel.content : [zettel.content]
+  for (const line of content) {
+    length += countTerms(terms, line)
+  }
+  return {key: `zettel:${id}`, type: 'zettel', ref: id, length, terms}
+}
+
+async function indexFile(index: SearchIndex, notesDir: string, fileName: string) {
+  const key = `article:${fileName}`
+  const article = await findFileArticle(notesDir, fileName)
+  if (!article) {
+    removeDoc(index, key)
+    return
+  }
+
+  let source: string
+  try {
+    source = await fs.promises.readFile(path.join(notesDir, fileName), 'utf8')
+  } catch (e) {
+    removeDoc(index, key)
+    return
+  }
+
+  const terms = new Map<string, number>()
+  let length = countTerms(terms, article.title, TITLE_WEIGHT)
+  // the first line is the title
+  length += countTerms(terms, source.slice(source.indexOf('\n') + 1))
+  addDoc(index, {key, type: 'article', ref: fileName, length, terms})
+}
+
+function applyZettelChanges(index: SearchIndex, zettels: Zettels) {
+  const changes = index.zettelChanges
+  index.zettelChanges = []
+
+  if (changes.includes(null)) {
+    for (const doc of [...index.docs.values()]) {
+      if (doc.type === 'zettel') {
+        removeDoc(index, doc.key)
+      }
+    }
+    for (const id of Object.keys(zettels.ids)) {
+      addDoc(index, zettelDoc(id, zettels))
+    }
+    return
+  }
+
+  const changed = new Set<string>()
+  for (const change of changes) {
+    change.removed.forEach((id) => changed.add(id))
+    change.added.forEach((id) => changed.add(id))
+  }
+  for (const id of changed) {
+    if (zettels.ids[id]) {
+      addDoc(index, zettelDoc(id, zettels))
+    } else {
+      removeDoc(index, `zettel:${id}`)
+    }
+  }
+}
+
+function updateTerms(index: SearchIndex) {
+  if (index.newTerms.size === 0) {
+    return
+  }
+  if (index.newTerms.size > MAX_TERM_INSERTS) {
+    index.terms = [...index.postings.keys()].sort()
+  } else {
+    // drop removed terms while inserting
+    const terms = index.terms.filter((term) => index.postings.has(term))
+    for (const term of index.newTerms) {
+      terms.splice(sortedIndex(terms, term), 0, term)
+    }
+    index.terms = terms
+  }
+  index.newTerms.clear()
+}
+
+function loadZettels(index: SearchIndex): Promise<Zettels> {
+  return getZettels(index.zettelsFile).catch((e) => {
+    logger.error('search zettels: ', e)
+    return {tags: {}, ids: {}}
+  })
+}
+
+async function sync(index: SearchIndex, notesDir: string) {
+  // reports changes to the index listeners
+  const zettels = await loadZettels(index)
+
+  if (index.scan) {
+    index.scan = false
+    for (const article of Object.values(await getCatalogArticles(notesDir))) {
+      index.dirtyFiles.add(article.fileName)
+    }
+  }
+
+  const fileNames = [...index.dirtyFiles]
+  index.dirtyFiles.clear()
+  const zettelsFileName = path.basename(index.zettelsFile)
+  for (const fileName of fileNames) {
+    // zettels are indexed one by one
+    if (fileName !== zettelsFileName) {
+      await indexFile(index, notesDir, fileName)
+    }
+  }
+
+  applyZettelChanges(index, zettels)
+  updateTerms(index)
+}
+
+async function getSearchIndex(notesDir: string, extension: string): Promise<SearchIndex> {
+  const zettelsFile = path.join(notesDir, 'zettels' + extension)
+  if (!indexes[zettelsFile]) {
+    const created: SearchIndex = indexes[zettelsFile] = {
+      docs: new Map(),
+      postings: new Map(),
+      terms: [],
+      newTerms: new Set(),
+      totalLength: 0,
+      zettelsFile,
+      dirtyFiles: new Set(),
+      zettelChanges: [null],
+      scan: true,
+      syncing: null,
+    }
+    watchArticles(notesDir, (fileName) => created.dirtyFiles.add(fileName))
+    watchZettels(zettelsFile, (change) => created.zettelChanges.push(change))
+  }
+
+  const index = indexes[zettelsFile]
+  if (!index.syncing) {
+    index.syncing = sync(index, notesDir)
+      .catch((e) => {
+        logger.error('search index: ', e)
+      })
+      .finally(() => {
+        index.syncing = null
+      })
+  }
+  await index.syncing
+  return index
+}
+
+function expandTerm(index: SearchIndex, term: string, isPrefix: boolean) {
+  if (!isPrefix) {
+    return index.postings.has(term) ? [term] : []
+  }
+
+  const terms = []
+  for (let i = sortedIndex(index.terms, term); i < index.terms.length; i++) {
+    const candidate = index.terms[i]
+    if (!candidate.startsWith(term) || terms.length === MAX_PREFIX_TERMS) {
+      break
+    }
+    if (index.postings.has(candidate)) {
+      terms.push(candidate)
+    }
+  }
+  return terms
+}
+
+/**
+ * Score of each document matching one query term, the best expansion wins
+ */
+function scoreTerm(index: SearchIndex, terms: string[]) {
+  const scores = new Map<string, number>()
+  const docCount = index.docs.size
+  const avgLength = index.totalLength / Math.max(docCount, 1)
+
+  for (const term of terms) {
+    const posting = index.postings.get(term)
+    const idf = Math.log(1 + (docCount - posting.size + 0.5) / (posting.size + 0.5))
+    for (const [key, tf] of posting) {
+      const length = index.docs.get(key).length
+      const score = idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * length / avgLength))
+      if (score > (scores.get(key) || 0)) {
+        scores.set(key, score)
+      }
+    }
+  }
+  return scores
+}
+
+function toResult(doc: Doc, score: number, zettels: Zettels, articles: {[fileName: string]: Article}): SearchResult {
+  if (doc.type === 'zettel') {
+    const zettel = zettels.ids[doc.ref]
+    const content = Array.isArray(zettel.content) ? zettel.content.join(' ') : zettel.content
+    return {
+      type: 'zettel',
+      id: doc.ref,
+      title: content.slice(0, SNIPPET_LENGTH),
+      tags: [...zettel.tags],
+      score,
+    }
+  }
+
+  const article = articles[doc.ref]
+  return {
+    type: 'article',
+    title: article.title,
+    slug: article.slug,
+    fileName: article.fileName,
+    score,
+  }
+}
+
+/**
+ * Documents matching every term of `query`, best first
+ */
+export async function search(notesDir: string, extension: string, query: string, limit = 50): Promise<SearchResult[]> {
+  const tokens = tokenize(query)
+  if (tokens.length === 0) {
+    return []
+  }
+
+  const index = await getSearchIndex(notesDir, extension)
+  // the last term is still being typed unless followed by a space
+  const isTyping = !/\s$/.test(query)
+  const termScores = tokens
+    .map((token, i) => scoreTerm(index, expandTerm(index, token, isTyping && i === tokens.length - 1)))
+    .sort((a, b) => a.size - b.size)
+
+  const scores = new Map<string, number>()
+  for (const [key, score] of termScores[0]) {
+    let total = score
+    for (const other of termScores.slice(1)) {
+      const otherScore = other.get(key)
+      if (otherScore === undefined) {
+        total = -1
+        break
+      }
+      total += otherScore
+    }
+    if (total >= 0) {
+      scores.set(key, total)
+    }
+  }
+
+  const zettels = await loadZettels(index)
+  const articles: {[fileName: string]: Article} = {}
+  for (const article of Object.values(await getCatalogArticles(notesDir))) {
+    articles[article.fileName] = article
+  }
+
+  return [...scores]
+    .sort((a, b) => b[1] - a[1])
+    .slice(0, limit)
+    .map(([key, score]) => ({doc: index.docs.get(key), score}))
+    // skip documents changed since the last sync
+    .filter(({doc}) => doc.type === 'zettel' ? zettels.ids[doc.ref] : articles[doc.ref])
+    .map(({doc, score}) => toResult(doc, score, zettels, articles))
+}
@@ -0,0 +1,208 @@
+import * as crypto from 'crypto'
+import * as fs from 'fs'
+import * as os from 'os'
+import * as path from 'path'
+import * as v8 from 'v8'
+import {CatalogSnapshot, restoreCatalog, snapshotCatalog, watchArticles} from './catalog'
+import {Note, restoreNotes, snapshotNotes} from './notes'
+import {PostingsSnapshot, restorePostings, snapshotPostings} from './query'
+import {
+  getZettels,
+  restoreShards,
+  restoreZettels,
+  ShardSnapshots,
+  snapshotShards,
+  snapshotZettels,
+  watchZettels,
+  ZettelsSnapshot,
+} from './store'
+import {restoreStructures, snapshotStructures, StructuresSnapshot} from './structures'
+
+const logger = require('../util/logger')('zortex/snapshot') // tslint:disable-line
+
+/*
+ * Indexes of a notes directory saved to disk, so that starting the server,
+ * the REPL or a CLI command doesn't parse notes which didn't change.
+ *
+ * A snapshot is a header followed by the v8 serialization of the indexes.
+ * Nothing in it is trusted: zettels are used only if the file still hashes
+ * the same, and everything else is checked against file mtimes and sizes
+ * like the indexes kept in memory are.
+ */
+
+interface Snapshot {
+  zettelsFile: string
+  zettels: ZettelsSnapshot | null
+  // indexes of each shard, when zettels are sharded
+  shards: ShardSnapshots | null
+  // of the zettels file, or of the zettels merged from the shards
+  postings: PostingsSnapshot | null
+  catalog: CatalogSnapshot | null
+  notes: Note[] | null
+  structures: StructuresSnapshot | null
+}
+
+const MAGIC = 'ZTXS'
+// bump when the layout of any saved index changes
+const VERSION = 3
+const HEADER_SIZE = 8
+// time to wait for more changes before saving again
+const SAVE_DELAY = 10000
+
+// last snapshot loaded or saved, parts missing from memory are saved from it
+const snapshots: {[notesDir: string]: Snapshot} = {}
+const kept = new Set<string>()
+
+function snapshotPath(notesDir: string) {
+  const cacheDir = process.env.XDG_CACHE_HOME || path.join(os.homedir(), '.cache')
+  const name = crypto.createHash('sha1').update(path.resolve(notesDir)).digest('hex').slice(0, 16)
+  return path.join(cacheDir, 'zortex', `${name}.snapshot`)
+}
+
+function defaultZettelsFile(notesDir: string, extension: string) {
+  return path.join(notesDir, 'zettels' + extension)
+}
+
+async function readSnapshot(notesDir: string): Promise<Snapshot | null> {
+  let data: Buffer
+  try {
+    data = await fs.promises.readFile(snapshotPath(notesDir))
+  } catch (e) {
+    if (e.code !== 'ENOENT') {
+      logger.error('read snapshot: ', e)
+    }
+    return null
+  }
+  if (
+    data.length < HEADER_SIZE ||
+    data.toString('latin1', 0, 4) !== MAGIC ||
+    data.readUInt32LE(4) !== VERSION
+  ) {
+    return null
+  }
+  try {
+    return v8.deserialize(data.subarray(HEADER_SIZE))
+  } catch (e) {
+    logger.error('deserialize snapshot: ', e)
+    return null
+  }
+}
+
+/**
+ * Seed the indexes of `notesDir` from its snapshot, return whether the
+ * zettels of `zettelsFile` were restored without parsing
+ */
+export async function loadSnapshot(
+  notesDir: string,
+  extension: string,
+  zettelsFile = defaultZettelsFile(notesDir, extension)
+): Promise<boolean> {
+  const snapshot = await readSnapshot(notesDir)
+  if (!snapshot) {
+    return false
+  }
+  snapshots[notesDir] = snapshot
+
+  if (snapshot.structures) {
+    restoreStructures(notesDir, extension, snapshot.structures)
+  }
+  if (snapshot.notes) {
+    restoreNotes(notesDir, snapshot.notes)
+  }
+  if (snapshot.catalog) {
+    restoreCatalog(notesDir, snapshot.catalog)
+  }
+
+  let restored = false
+  if (snapshot.shards && snapshot.zettelsFile === zettelsFile) {
+    restored = await restoreShards(zettelsFile, snapshot.shards)
+    // postings are numbered for the merged zettels, which merging the
+    // restored shards builds again
+    if (restored && snapshot.postings) {
+      try {
+        restorePostings(await getZettels(zettelsFile), snapshot.postings)
+      } catch (e) {
+        logger.error('restore postings: ', e)
+      }
+    }
+  } else if (snapshot.zettels && snapshot.zettelsFile === zettelsFile) {
+    try {
+      restored = await restoreZettels(zettelsFile, snapshot.zettels)
+    } catch (e) {
+      if (e.code !== 'ENOENT') {
+        logger.error('restore zettels: ', e)
+      }
+    }
+    // postings are numbered for exactly the saved zettels
+    if (restored && snapshot.postings) {
+      restorePostings(snapshot.zettels.zettels, snapshot.postings)
+    }
+  }
+
+  return restored
+}
+
+/**
+ * Save the indexes of `notesDir` built so far
+ */
+export async function saveSnapshot(
+  notesDir: string,
+  extension: string,
+  zettelsFile = defaultZettelsFile(notesDir, extension)
+) {
+  const previous = snapshots[notesDir]
+  // the zettels file of sharded zettels is one of the shards
+  const sharded = snapshotShards(zettelsFile)
+  const zettels = sharded ? null : snapshotZettels(zettelsFile)
+  const indexed = sharded !== null || zettels !== null
+  const samePrevious = previous?.zettelsFile === zettelsFile ? previous : null
+  const snapshot: Snapshot = {
+    zettelsFile,
+    zettels: indexed ? zettels : samePrevious?.zettels || null,
+    shards: indexed ? sharded?.shards || null : samePrevious?.shards || null,
+    postings: indexed
+      ? snapshotPostings(sharded ? sharded.zettels : zettels.zettels)
+      : samePrevious?.postings || null,
+    catalog: (await snapshotCatalog(notesDir)) || previous?.catalog || null,
+    notes: snapshotNotes(notesDir) || previous?.notes || null,
+    structures: snapshotStructures(notesDir, extension) || previous?.structures || null,
+  }
+
+  const header = Buffer.alloc(HEADER_SIZE)
+  header.write(MAGIC, 0, 'latin1')
+  header.writeUInt32LE(VERSION, 4)
+  const filepath = snapshotPath(notesDir)
+  const tmpFilepath = `${filepath}.${process.pid}`
+  await fs.promises.mkdir(path.dirname(filepath), {recursive: true})
+  await fs.promises.writeFile(tmpFilepath, Buffer.concat([header, v8.serialize(snapshot)]))
+  await fs.promises.rename(tmpFilepath, filepath)
+  snapshots[notesDir] = snapshot
+}
+
+/**
+ * Load the snapshot of `notesDir`, index zettels and save the snapshot again
+ * whenever zettels or articles change
+ */
+export async function keepSnapshot(notesDir: string, extension: string) {
+  if (kept.has(notesDir)) {
+    return
+  }
+  kept.add(notesDir)
+
+  let timer: NodeJS.Timeout = null
+  const save = () => saveSnapshot(notesDir, extension).catch((e) => logger.error('save snapshot: ', e))
+  const scheduleSave = () => {
+    clearTimeout(timer)
+    timer = setTimeout(save, SAVE_DELAY)
+    timer.unref()
+  }
+
+  const zettelsFile = defaultZettelsFile(notesDir, extension)
+  const restored = await loadSnapshot(notesDir, extension, zettelsFile)
+  await getZettels(zettelsFile).catch((e) => logger.error('zettels: ', e))
+  watchZettels(zettelsFile, scheduleSave)
+  watchArticles(notesDir, scheduleSave)
+  if (!restored) {
+    await save()
+  }
+}
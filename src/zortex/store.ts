@@ -0,0 +1,817 @@
+import * as crypto from 'crypto'
+import * as fs from 'fs'
+import * as path from 'path'
+import {Zettels} from './types'
+import {newZettelId, parseZettelTags, toZettel, zettelRE} from './zettel'
+import {updatePostings} from './query'
+import {parseInWorker, WorkerUnavailable} from './workers'
+
+const logger = require('../util/logger')('zortex/store') // tslint:disable-line
+
+/*
+ * Long-lived zettel index owned by the server process.
+ *
+ * The zettels file is kept in memory together with the byte offset of every
+ * zettel. The file is only read again when its mtime or size changes, and
+ * then only the zettels overlapping the changed bytes are parsed again.
+ *
+ * Zettels can also be split into shards: every file of the directory named
+ * like the zettels file without its extension (zettels/ for zettels.zortex),
+ * and the zettels file itself if it exists. Each shard has its own index and
+ * their zettels are merged, so an edit only parses its own shard. Shards
+ * indexed from scratch are parsed in parallel on worker threads.
+ *
+ * New zettels are appended to the zettels file and added to its index in
+ * place, without reading the file again. Appends arriving while a batch is
+ * written are written together with a single fsync.
+ */
+
+export interface Entry {
+  id: string
+  // byte offset of the header line
+  start: number
+  // byte offset of the newline ending the header line
+  headerEnd: number
+  lineNumber: number
+}
+
+interface ZettelsIndex {
+  mtimeMs: number
+  size: number
+  source: Buffer
+  entries: Entry[]
+  zettels: Zettels
+}
+
+type Zettel = Zettels['ids'][string]
+
+/**
+ * Index saved to disk, `hash` is the sha1 of the zettels file it was built from
+ */
+export interface ZettelsSnapshot {
+  mtimeMs: number
+  size: number
+  hash: string
+  entries: Entry[]
+  zettels: Zettels
+}
+
+export type ShardSnapshots = {[shard: string]: ZettelsSnapshot}
+
+const NEWLINE = 10
+const CARRIAGE_RETURN = 13
+const CHUNK_SIZE = 4096
+
+/**
+ * Ids removed and added by an update (a re-parsed zettel is in both) and the
+ * tags of those zettels, null when the zettels were indexed from scratch
+ */
+export type ZettelsChange = null | {removed: string[]; added: string[]; tags: string[]}
+type ZettelsListener = (change: ZettelsChange) => void
+
+/**
+ * Zettels merged from the shards of a zettels file
+ */
+interface ShardedZettels {
+  zettels: Zettels
+  // id -> shard holding the zettel merged into `zettels`
+  owners: Map<string, string>
+  // shard -> ids of its zettels, with ids already taken by another shard
+  ids: Map<string, Set<string>>
+  // shards which couldn't be indexed, until their mtime or size changes
+  failed: Map<string, {mtimeMs: number; size: number}>
+}
+
+type ParsedZettels = Pick<ZettelsIndex, 'entries' | 'zettels'>
+
+const indexes: {[zettelsFile: string]: ZettelsIndex} = {}
+const shardedZettels: {[zettelsFile: string]: ShardedZettels} = {}
+const pending: {[zettelsFile: string]: Promise<Zettels>} = {}
+const listeners: {[zettelsFile: string]: Set<ZettelsListener>} = {}
+// appends waiting for the next batch
+const appendQueues: {[zettelsFile: string]: PendingAppend[]} = {}
+// batch being written
+const appending: {[zettelsFile: string]: Promise<void>} = {}
+
+export interface AppendedZettel {
+  id: string
+  lineNumber: number
+}
+
+interface PendingAppend {
+  tags: string[]
+  content: string | string[]
+  resolve: (zettel: AppendedZettel) => void
+  reject: (e: Error) => void
+}
+
+/**
+ * Parse the lines between two byte offsets, `start` must be the beginning of a line
+ */
+function parseRange(source: Buffer, start: number, end: number, firstLineNumber: number) {
+  const entries: Entry[] = []
+  const zettels: Zettel[] = []
+  let lineNumber = firstLineNumber - 1
+  let pos = start
+
+  while (pos < end) {
+    let newline = source.indexOf(NEWLINE, pos)
+    if (newline === -1 || newline > end) {
+      newline = end
+    }
+    lineNumber++
+
+    const lineEnd = newline > pos && source[newline - 1] === CARRIAGE_RETURN ? newline - 1 : newline
+    const line = source.toString('utf8', pos, lineEnd)
+    const match = line.match(zettelRE)
+
+    if (match) {
+      entries.push({id: match[1], start: pos, headerEnd: newline, lineNumber})
+      zettels.push({
+        lineNumber,
+        tags: parseZettelTags(match[2]),
+        content: match[3] ? match[3] : [],
+      })
+    } else if (zettels.length > 0) {
+      // If there is no match, merge information with previous zettel
+      const zettel = zettels[zettels.length - 1]
+      if (!Array.isArray(zettel.content)) {
+        zettel.content = [zettel.content]
+      }
+      zettel.content.push(line)
+    }
+
+    pos = newline + 1
+  }
+
+  return {entries, zettels}
+}
+
+/**
+ * Count the pairs of `tags` once more, or once less
+ */
+function relateTags(zettels: Zettels, tags: Set<string>, delta: 1 | -1) {
+  if (!zettels.related) {
+    zettels.related = {}
+  }
+  const related = zettels.related
+  for (const tag of tags) {
+    for (const other of tags) {
+      if (tag === other) {
+        continue
+      }
+      if (!related[tag]) {
+        related[tag] = new Map()
+      }
+      const count = (related[tag].get(other) || 0) + delta
+      if (count > 0) {
+        related[tag].set(other, count)
+      } else {
+        related[tag].delete(other)
+        if (related[tag].size === 0) {
+          delete related[tag]
+        }
+      }
+    }
+  }
+}
+
+function addZettel(zettels: Zettels, id: string, zettel: Zettel) {
+  if (zettels.ids[id]) {
+    throw new Error(
+      `Zettel id: ${id} already exists at line: ${zettels.ids[id].lineNumber}`
+    )
+  }
+
+  for (const tag of zettel.tags) {
+    if (!zettels.tags[tag]) {
+      zettels.tags[tag] = new Set()
+    }
+    zettels.tags[tag].add(id)
+  }
+  relateTags(zettels, zettel.tags, 1)
+  zettels.ids[id] = zettel
+}
+
+function removeZettel(zettels: Zettels, id: string) {
+  relateTags(zettels, zettels.ids[id].tags, -1)
+  for (const tag of zettels.ids[id].tags) {
+    zettels.tags[tag].delete(id)
+    if (zettels.tags[tag].size === 0) {
+      delete zettels.tags[tag]
+    }
+  }
+  delete zettels.ids[id]
+}
+
+function commonPrefix(a: Buffer, b: Buffer) {
+  const max = Math.min(a.length, b.length)
+  let pos = 0
+  while (pos + CHUNK_SIZE <= max && a.compare(b, pos, pos + CHUNK_SIZE, pos, pos + CHUNK_SIZE) === 0) {
+    pos += CHUNK_SIZE
+  }
+  while (pos < max && a[pos] === b[pos]) {
+    pos++
+  }
+  return pos
+}
+
+function commonSuffix(a: Buffer, b: Buffer, max: number) {
+  let len = 0
+  while (
+    len + CHUNK_SIZE <= max &&
+    a.compare(b, b.length - len - CHUNK_SIZE, b.length - len, a.length - len - CHUNK_SIZE, a.length - len) === 0
+  ) {
+    len += CHUNK_SIZE
+  }
+  while (len < max && a[a.length - 1 - len] === b[b.length - 1 - len]) {
+    len++
+  }
+  return len
+}
+
+function countLines(source: Buffer, start: number, end: number) {
+  let count = 0
+  let pos = source.indexOf(NEWLINE, start)
+  while (pos !== -1 && pos < end) {
+    count++
+    pos = source.indexOf(NEWLINE, pos + 1)
+  }
+  return count
+}
+
+/**
+ * Entries and zettels of a whole zettels file, also run by index workers
+ */
+export function indexSource(source: Buffer): ParsedZettels {
+  const {entries, zettels: parsed} = parseRange(source, 0, source.length, 1)
+  const zettels: Zettels = {tags: {}, related: {}, ids: {}}
+  entries.forEach((entry, i) => addZettel(zettels, entry.id, parsed[i]))
+
+  return {entries, zettels}
+}
+
+async function parseSource(source: Buffer): Promise<ParsedZettels> {
+  return indexSource(source)
+}
+
+async function parseSourceInWorker(source: Buffer): Promise<ParsedZettels> {
+  try {
+    return await parseInWorker(source)
+  } catch (e) {
+    if (e instanceof WorkerUnavailable) {
+      return indexSource(source)
+    }
+    throw e
+  }
+}
+
+function updateIndex(index: ZettelsIndex, source: Buffer): ZettelsChange {
+  const old = index.source
+  const entries = index.entries
+  const prefix = commonPrefix(old, source)
+  if (prefix === old.length && prefix === source.length) {
+    return {removed: [], added: [], tags: []}
+  }
+  const suffix = commonSuffix(old, source, Math.min(old.length, source.length) - prefix)
+  const changeEnd = old.length - suffix
+
+  // Start at the last zettel whose header line lies entirely before the change
+  let lo = 0
+  let hi = entries.length
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1
+    if (entries[mid].headerEnd < prefix) {
+      lo = mid + 1
+    } else {
+      hi = mid
+    }
+  }
+  const first = lo - 1
+
+  // Stop at the first zettel whose header line, including the preceding newline, is unchanged
+  hi = entries.length
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1
+    if (entries[mid].start <= changeEnd) {
+      lo = mid + 1
+    } else {
+      hi = mid
+    }
+  }
+  const last = lo
+
+  const rangeStart = first === -1 ? 0 : entries[first].start
+  const rangeLineNumber = first === -1 ? 1 : entries[first].lineNumber
+  const oldRangeEnd = last < entries.length ? entries[last].start : old.length
+  const byteDelta = source.length - old.length
+  const newRangeEnd = oldRangeEnd + byteDelta
+  const lineDelta = countLines(source, rangeStart, newRangeEnd) - countLines(old, rangeStart, oldRangeEnd)
+
+  const tags = new Set<string>()
+  const removed = entries.slice(Math.max(first, 0), last)
+  for (const entry of removed) {
+    index.zettels.ids[entry.id].tags.forEach((tag) => tags.add(tag))
+    removeZettel(index.zettels, entry.id)
+  }
+
+  for (const entry of entries.slice(last)) {
+    entry.start += byteDelta
+    entry.headerEnd += byteDelta
+    entry.lineNumber += lineDelta
+    index.zettels.ids[entry.id].lineNumber += lineDelta
+  }
+
+  const parsed = parseRange(source, rangeStart, newRangeEnd, rangeLineNumber)
+  parsed.entries.forEach((entry, i) => addZettel(index.zettels, entry.id, parsed.zettels[i]))
+  parsed.zettels.forEach((zettel) => zettel.tags.forEach((tag) => tags.add(tag)))
+
+  entries.splice(Math.max(first, 0), removed.length, ...parsed.entries)
+  index.source = source
+  index.zettels.version = (index.zettels.version || 0) + 1
+
+  return {
+    removed: removed.map((entry) => entry.id),
+    added: parsed.entries.map((entry) => entry.id),
+    tags: [...tags],
+  }
+}
+
+/**
+ * Bring the index of a zettels file up to date, return the change or
+ * undefined when the file didn't change
+ */
+async function refreshIndex(
+  zettelsFile: string,
+  stat: fs.Stats,
+  parse: (source: Buffer) => Promise<ParsedZettels>
+): Promise<ZettelsChange | undefined> {
+  let index = indexes[zettelsFile]
+  if (index && index.mtimeMs === stat.mtimeMs && index.size === stat.size) {
+    return undefined
+  }
+
+  const source = await fs.promises.readFile(zettelsFile)
+  let change: ZettelsChange = null
+  try {
+    if (index) {
+      change = updateIndex(index, source)
+    } else {
+      index = indexes[zettelsFile] = {mtimeMs: 0, size: 0, source, ...(await parse(source))}
+    }
+  } catch (e) {
+    // The index may be partially updated, parse from scratch next time
+    delete indexes[zettelsFile]
+    throw e
+  }
+
+  index.mtimeMs = stat.mtimeMs
+  index.size = stat.size
+  return change
+}
+
+// pass an update of `zettels` to its query engine, then to the listeners
+function notify(zettelsFile: string, zettels: Zettels, change: ZettelsChange) {
+  updatePostings(zettels, change)
+  listeners[zettelsFile]?.forEach((listener) => listener(change))
+}
+
+async function refreshFile(zettelsFile: string, stat: fs.Stats): Promise<Zettels> {
+  const change = await refreshIndex(zettelsFile, stat, parseSource)
+  if (change !== undefined) {
+    notify(zettelsFile, indexes[zettelsFile].zettels, change)
+  }
+  return indexes[zettelsFile].zettels
+}
+
+function mergeZettel(sharded: ShardedZettels, shard: string, id: string, tags: Set<string>) {
+  const zettel = indexes[shard].zettels.ids[id]
+  zettel.shard = path.basename(shard)
+  addZettel(sharded.zettels, id, zettel)
+  sharded.owners.set(id, shard)
+  zettel.tags.forEach((tag) => tags.add(tag))
+}
+
+function unmergeZettel(sharded: ShardedZettels, id: string, tags: Set<string>) {
+  sharded.zettels.ids[id].tags.forEach((tag) => tags.add(tag))
+  removeZettel(sharded.zettels, id)
+  sharded.owners.delete(id)
+}
+
+/**
+ * Apply the ids a shard removed and added to the merged zettels
+ */
+function mergeShard(
+  sharded: ShardedZettels,
+  shard: string,
+  removed: Iterable<string>,
+  added: Iterable<string>,
+  change: {removed: Set<string>; added: Set<string>; tags: Set<string>}
+) {
+  if (!sharded.ids.has(shard)) {
+    sharded.ids.set(shard, new Set())
+  }
+  const shardIds = sharded.ids.get(shard)
+  const addedIds = new Set(added)
+
+  for (const id of removed) {
+    shardIds.delete(id)
+    if (sharded.owners.get(id) !== shard) {
+      continue
+    }
+    unmergeZettel(sharded, id, change.tags)
+    change.removed.add(id)
+    // a shard with the same id takes over, unless this shard added it again
+    if (!addedIds.has(id)) {
+      for (const [other, ids] of sharded.ids) {
+        if (ids.has(id) && indexes[other]?.zettels.ids[id]) {
+          mergeZettel(sharded, other, id, change.tags)
+          change.added.add(id)
+          break
+        }
+      }
+    }
+  }
+
+  for (const id of addedIds) {
+    shardIds.add(id)
+    const owner = sharded.owners.get(id)
+    if (owner !== undefined && owner !== shard) {
+      logger.error(`Zettel id: ${id} of ${shard} already exists in ${owner}`)
+      continue
+    }
+    if (owner === shard) {
+      unmergeZettel(sharded, id, change.tags)
+    }
+    mergeZettel(sharded, shard, id, change.tags)
+    change.added.add(id)
+  }
+
+  if (shardIds.size === 0) {
+    sharded.ids.delete(shard)
+  }
+}
+
+async function listShards(zettelsFile: string, shardsDir: string) {
+  const extension = path.extname(zettelsFile)
+  const items = await fs.promises.readdir(shardsDir, {withFileTypes: true})
+  const shards = items
+    .filter((item) => !item.isDirectory() && item.name.endsWith(extension))
+    .map((item) => path.join(shardsDir, item.name))
+    .sort()
+  if (fs.existsSync(zettelsFile)) {
+    shards.push(zettelsFile)
+  }
+  return shards
+}
+
+async function refreshShards(zettelsFile: string, shardsDir: string): Promise<Zettels> {
+  const isNew = !shardedZettels[zettelsFile]
+  if (isNew) {
+    shardedZettels[zettelsFile] = {
+      zettels: {tags: {}, related: {}, ids: {}, version: 0},
+      owners: new Map(),
+      ids: new Map(),
+      failed: new Map(),
+    }
+  }
+  const sharded = shardedZettels[zettelsFile]
+  const change = {removed: new Set<string>(), added: new Set<string>(), tags: new Set<string>()}
+
+  const shards = await listShards(zettelsFile, shardsDir)
+  const stats = await Promise.all(shards.map((shard) => fs.promises.stat(shard).catch((): null => null)))
+  // parse on worker threads only when there is more than one shard to parse
+  const unindexed = shards.filter((shard) => !indexes[shard]).length
+  const parse = unindexed > 1 ? parseSourceInWorker : parseSource
+
+  const results = await Promise.all(
+    shards.map(async (shard, i) => {
+      const stat = stats[i]
+      const failed = sharded.failed.get(shard)
+      // removed since listed, or failed and unchanged since
+      if (!stat || (failed && failed.mtimeMs === stat.mtimeMs && failed.size === stat.size)) {
+        return {shard, update: undefined, failed: true}
+      }
+      try {
+        const update = await refreshIndex(shard, stat, parse)
+        sharded.failed.delete(shard)
+        return {shard, update, failed: false}
+      } catch (e) {
+        logger.error('index zettels: ', shard, e)
+        sharded.failed.set(shard, {mtimeMs: stat.mtimeMs, size: stat.size})
+        return {shard, update: undefined, failed: true}
+      }
+    })
+  )
+
+  // shards which are gone or failed lose their zettels
+  const current = new Set(results.filter((result) => !result.failed).map((result) => result.shard))
+  for (const [shard, ids] of [...sharded.ids]) {
+    if (!current.has(shard)) {
+      mergeShard(sharded, shard, [...ids], [], change)
+      delete indexes[shard]
+    }
+  }
+  for (const shard of sharded.failed.keys()) {
+    if (!shards.includes(shard)) {
+      sharded.failed.delete(shard)
+    }
+  }
+
+  // merged in shard order, so the first shard keeps a duplicated id
+  for (const {shard, update, failed} of results) {
+    // shards indexed before, e.g. the zettels file, are new to merged zettels
+    const fresh = update === null || (update === undefined && isNew)
+    if (failed || (update === undefined && !fresh)) {
+      continue
+    }
+    const removed = fresh ? [...(sharded.ids.get(shard) || [])] : update.removed
+    const added = fresh ? Object.keys(indexes[shard].zettels.ids) : update.added
+    mergeShard(sharded, shard, removed, added, change)
+  }
+
+  if (isNew || change.removed.size > 0 || change.added.size > 0) {
+    sharded.zettels.version++
+    const merged: ZettelsChange = isNew
+      ? null
+      : {removed: [...change.removed], added: [...change.added], tags: [...change.tags]}
+    notify(zettelsFile, sharded.zettels, merged)
+  }
+  return sharded.zettels
+}
+
+async function refreshZettels(zettelsFile: string): Promise<Zettels> {
+  const parsed = path.parse(zettelsFile)
+  const shardsDir = path.join(parsed.dir, parsed.name)
+  const shardsStat = await fs.promises.stat(shardsDir).catch((): null => null)
+  if (shardsStat?.isDirectory()) {
+    return refreshShards(zettelsFile, shardsDir)
+  }
+
+  const sharded = shardedZettels[zettelsFile]
+  if (!sharded) {
+    return refreshFile(zettelsFile, await fs.promises.stat(zettelsFile))
+  }
+
+  // the shards are gone, the zettels of the file replace the merged ones
+  delete shardedZettels[zettelsFile]
+  for (const shard of [...sharded.ids.keys(), ...sharded.failed.keys()]) {
+    if (shard !== zettelsFile) {
+      delete indexes[shard]
+    }
+  }
+  const index = indexes[zettelsFile]
+  if (index) {
+    Object.values(index.zettels.ids).forEach((zettel) => delete zettel.shard)
+    index.zettels.version = (index.zettels.version || 0) + 1
+  }
+  try {
+    return await refreshFile(zettelsFile, await fs.promises.stat(zettelsFile))
+  } finally {
+    listeners[zettelsFile]?.forEach((listener) => listener(null))
+  }
+}
+
+/**
+ * Call `listener` with the ids changed by each update of the zettels index
+ */
+export function watchZettels(zettelsFile: string, listener: ZettelsListener) {
+  if (!listeners[zettelsFile]) {
+    listeners[zettelsFile] = new Set()
+  }
+  listeners[zettelsFile].add(listener)
+  return () => listeners[zettelsFile].delete(listener)
+}
+
+/**
+ * Return the zettels indexed from `zettelsFile`, parsing only what changed since the last call
+ */
+export function getZettels(zettelsFile: string): Promise<Zettels> {
+  if (!pending[zettelsFile]) {
+    pending[zettelsFile] = refreshZettels(zettelsFile).finally(() => {
+      delete pending[zettelsFile]
+    })
+  }
+  return pending[zettelsFile]
+}
+
+/**
+ * Add the zettels appended to a file to its index, return the change or null
+ * when they can't be added in place
+ */
+function appendToIndex(index: ZettelsIndex, data: Buffer, offset: number, stat: fs.Stats): ZettelsChange {
+  const start = index.source.length + offset
+  const source = Buffer.concat([index.source, data])
+  const last = index.entries[index.entries.length - 1]
+  const lineNumber = last ? last.lineNumber + countLines(source, last.start, start) : countLines(source, 0, start) + 1
+  const parsed = parseRange(source, start, source.length, lineNumber)
+
+  const ids = new Set<string>()
+  for (const entry of parsed.entries) {
+    if (index.zettels.ids[entry.id] || ids.has(entry.id)) {
+      return null
+    }
+    ids.add(entry.id)
+  }
+
+  const tags = new Set<string>()
+  parsed.entries.forEach((entry, i) => addZettel(index.zettels, entry.id, parsed.zettels[i]))
+  parsed.zettels.forEach((zettel) => zettel.tags.forEach((tag) => tags.add(tag)))
+  index.entries.push(...parsed.entries)
+  index.source = source
+  index.mtimeMs = stat.mtimeMs
+  index.size = stat.size
+  index.zettels.version = (index.zettels.version || 0) + 1
+
+  return {removed: [], added: [...ids], tags: [...tags]}
+}
+
+async function appendFile(filepath: string, data: Buffer) {
+  const file = await fs.promises.open(filepath, 'a')
+  try {
+    const before = await file.stat()
+    await file.appendFile(data)
+    await file.sync()
+    return {before, after: await file.stat()}
+  } finally {
+    await file.close()
+  }
+}
+
+async function writeAppends(zettelsFile: string, batch: PendingAppend[]): Promise<Zettels> {
+  let zettels: Zettels = null
+  try {
+    zettels = await refreshZettels(zettelsFile)
+  } catch (e) {
+    // the first zettel creates the file
+    if (e.code !== 'ENOENT') {
+      batch.forEach((append) => append.reject(e))
+      throw e
+    }
+  }
+
+  // a new id is unique among the merged zettels and the file's own, which
+  // include ids shadowed by another shard
+  const index = indexes[zettelsFile]
+  const ids: string[] = []
+  const lines = batch.map(({tags, content}) => {
+    let id = newZettelId()
+    while (zettels?.ids[id] || index?.zettels.ids[id] || ids.includes(id)) {
+      id = newZettelId()
+    }
+    ids.push(id)
+    return toZettel(id, tags, content)
+  })
+  const separator = index && index.source.length > 0 && index.source[index.source.length - 1] !== NEWLINE ? '\n' : ''
+  const data = Buffer.from(separator + lines.join('\n') + '\n')
+
+  let change: ZettelsChange = null
+  try {
+    const {before, after} = await appendFile(zettelsFile, data)
+    // indexed in place unless another writer changed the file meanwhile
+    const unchanged =
+      index &&
+      indexes[zettelsFile] === index &&
+      before.mtimeMs === index.mtimeMs &&
+      before.size === index.size &&
+      after.size === before.size + data.length
+    change = unchanged ? appendToIndex(index, data, separator.length, after) : null
+  } catch (e) {
+    batch.forEach((append) => append.reject(e))
+    return zettels || refreshZettels(zettelsFile)
+  }
+
+  if (!change) {
+    try {
+      zettels = await refreshZettels(zettelsFile)
+    } catch (e) {
+      batch.forEach((append) => append.reject(e))
+      throw e
+    }
+  } else if (shardedZettels[zettelsFile]) {
+    const sharded = shardedZettels[zettelsFile]
+    const merged = {removed: new Set<string>(), added: new Set<string>(), tags: new Set<string>()}
+    mergeShard(sharded, zettelsFile, [], change.added, merged)
+    sharded.zettels.version++
+    zettels = sharded.zettels
+    notify(zettelsFile, sharded.zettels, {removed: [], added: [...merged.added], tags: [...merged.tags]})
+  } else {
+    zettels = index.zettels
+    notify(zettelsFile, zettels, change)
+  }
+
+  batch.forEach((append, i) => append.resolve({id: ids[i], lineNumber: zettels.ids[ids[i]]?.lineNumber}))
+  return zettels
+}
+
+// write the queued appends once the index is no longer refreshed, as the
+// refresh getZettels calls wait for
+async function flushAppends(zettelsFile: string) {
+  const batch = appendQueues[zettelsFile]
+  delete appendQueues[zettelsFile]
+  while (pending[zettelsFile]) {
+    await pending[zettelsFile].catch((): null => null)
+  }
+  pending[zettelsFile] = writeAppends(zettelsFile, batch).finally(() => {
+    delete pending[zettelsFile]
+  })
+  await pending[zettelsFile].catch((e) => logger.error('append zettels: ', zettelsFile, e))
+}
+
+/**
+ * Append a zettel with a new id to `zettelsFile` and index it, resolve to its
+ * id and line number once it is on disk
+ */
+export function appendZettel(zettelsFile: string, tags: string[], content: string | string[]): Promise<AppendedZettel> {
+  if (tags.some((tag) => tag === '' || /[#\s]/.test(tag))) {
+    return Promise.reject(new Error(`invalid tags: ${tags.join(', ')}`))
+  }
+  return new Promise((resolve, reject) => {
+    if (!appendQueues[zettelsFile]) {
+      appendQueues[zettelsFile] = []
+      // appends made until the previous batch is written join this one
+      const previous = appending[zettelsFile] || Promise.resolve()
+      const batch = (appending[zettelsFile] = previous
+        .then(() => new Promise((next) => setImmediate(next)))
+        .then(() => flushAppends(zettelsFile))
+        .finally(() => {
+          if (appending[zettelsFile] === batch) {
+            delete appending[zettelsFile]
+          }
+        }))
+    }
+    appendQueues[zettelsFile].push({tags, content, resolve, reject})
+  })
+}
+
+function hashSource(source: Buffer) {
+  return crypto.createHash('sha1').update(source).digest('hex')
+}
+
+/**
+ * Index of `zettelsFile` to save, null if it wasn't indexed
+ */
+export function snapshotZettels(zettelsFile: string): ZettelsSnapshot | null {
+  const index = indexes[zettelsFile]
+  if (!index) {
+    return null
+  }
+  const {mtimeMs, size, source, entries, zettels} = index
+  return {mtimeMs, size, hash: hashSource(source), entries, zettels}
+}
+
+/**
+ * Indexes of the shards of `zettelsFile` to save and the zettels merged from
+ * them, null if it isn't sharded
+ */
+export function snapshotShards(zettelsFile: string): {shards: ShardSnapshots; zettels: Zettels} | null {
+  const sharded = shardedZettels[zettelsFile]
+  if (!sharded) {
+    return null
+  }
+  const shards: ShardSnapshots = {}
+  for (const shard of sharded.ids.keys()) {
+    const snapshot = snapshotZettels(shard)
+    if (snapshot) {
+      shards[shard] = snapshot
+    }
+  }
+  return {shards, zettels: sharded.zettels}
+}
+
+/**
+ * Use the saved indexes of the shards of `zettelsFile` which are unchanged
+ * since, the next getZettels merges them. Return whether all of them were used
+ */
+export async function restoreShards(zettelsFile: string, shards: ShardSnapshots): Promise<boolean> {
+  if (shardedZettels[zettelsFile] || pending[zettelsFile] || Object.keys(shards).length === 0) {
+    return false
+  }
+  const restored = await Promise.all(
+    Object.keys(shards).map((shard) => restoreZettels(shard, shards[shard]).catch((): boolean => false))
+  )
+  return restored.every((used) => used)
+}
+
+/**
+ * Use a saved index if `zettelsFile` is unchanged since and wasn't indexed
+ * yet, return whether it was used
+ */
+export async function restoreZettels(zettelsFile: string, snapshot: ZettelsSnapshot): Promise<boolean> {
+  if (indexes[zettelsFile] || pending[zettelsFile]) {
+    return false
+  }
+  const stat = await fs.promises.stat(zettelsFile)
+  if (stat.mtimeMs !== snapshot.mtimeMs || stat.size !== snapshot.size) {
+    return false
+  }
+  const source = await fs.promises.readFile(zettelsFile)
+  // indexed meanwhile
+  if (indexes[zettelsFile] || pending[zettelsFile] || hashSource(source) !== snapshot.hash) {
+    return false
+  }
+
+  const {mtimeMs, size, entries, zettels} = snapshot
+  indexes[zettelsFile] = {mtimeMs, size, source, entries, zettels}
+  return true
+}
@@ -1,84 +1,56 @@
+import * as fs from 'fs'
 import * as path from 'path'
-import {Structure, Structures} from './types'
-import {getArticleFilepath, readLines} from './helpers'
-import {compareArticleNames, compareArticle, slugifyArticleName} from './wiki'
+import {Structure, StructureNode, Structures} from './types'
+import {slugifyArticleName} from './wiki'
 
 /*
- * - how to make level of nesting equal to number of each item in array?
- * - information related to root structures should not be including in recusion
- * - should be efficient for items at same nesting level
+ * Structures of a notes directory, parsed in a single pass into a tree and
+ * kept until structure.zortex changes.
  *
- * - should each call handle one level of nesting
+ * Root structures are lines with a '*' bullet, their branch holds the '-'
+ * lines indented under them.
  */
 
-/*
-const lineRE = /^(\s*)(\*|-) (\[)?([^\]]*?)]?( #.*#)?$/
-export async function getArticleStructures(notesDir: string, extension: string): Promise<Structures> {
-  const structuresFilepath = path.join(notesDir, 'structure' + extension)
-  const lines_ = readLines(structuresFilepath)
-  let m: RegExpMatchArray
-  const structures: Structures = {}
-
-  let currentLine = 0
-  let line: string
-  let rootIndent = null
-
-  const lines = []
-  for await (const line of lines_) {
-    lines.push(line)
-  }
-
-  const buildStructures = async (
-    currentIndent: number,
-    currentStructure: Structure
-  ) => {
-    line = lines[currentLine]
-    currentLine++
+export interface StructureIndex {
+  structures: Structures
+  // root structure name -> tree of its branch
+  trees: {[name: string]: StructureNode}
+  // lower case slug of a root or branch structure -> names of the roots
+  branches: Map<string, string[]>
+}
 
-    m = line.match(lineRE)
-    if (!m) {
-      return
-    }
+// index of structure.zortex as of its mtime and size, also saved to disk
+export interface StructuresSnapshot {
+  mtimeMs: number
+  size: number
+  index: StructureIndex
+}
 
-    const indent = m[1].length
-    const item = m[2]
-    const isLink = !!m[3]
-    const text = m[4]
+const lineRE = /^(\s*)(\*|-) (\[)?([^\]]*?)]?( #.*#)?$/
 
-    const structure: Structure = {
-      text,
-      slug: isLink ? slugifyArticleName(text) : null,
-      isLink,
-      structures: await buildStructures(indent, []),
-    }
-    currentStructures.push(structure)
+const caches: {[filepath: string]: StructuresSnapshot} = {}
 
-    if (item === '*') {
-      const tags = m[5] || ''
-      rootIndent = indent
-      structures[text] = {
-        tags: tags.trim().split('#').filter(v => v),
-        root: structure,
-      }
-    }
+function addBranch(branches: Map<string, string[]>, text: string, rootText: string) {
+  const slug = slugifyArticleName(text).toLowerCase()
+  const names = branches.get(slug)
+  if (!names) {
+    branches.set(slug, [rootText])
+  } else if (!names.includes(rootText)) {
+    names.push(rootText)
   }
-
-  await buildStructures(null, [])
-  return structures
 }
-*/
 
-const lineRE = /^(\s*)(\*|-) (\[)?([^\]]*?)]?( #.*#)?$/
-export async function getArticleStructures(notesDir: string, extension: string): Promise<Structures> {
-  const structuresFilepath = path.join(notesDir, 'structure' + extension)
-  const lines = readLines(structuresFilepath)
-  let m: RegExpMatchArray
+export function parseStructures(lines: string[]): StructureIndex {
+  const structures: Structures = {}
+  const trees: {[name: string]: StructureNode} = {}
+  const branches = new Map<string, string[]>()
   let rootText = null
   let rootIndent = null
-  const structures: Structures = {}
+  // nodes of the current branch from the root to the last line
+  let stack: StructureNode[] = []
 
-  for await (const line of lines) {
-    m = line.match(lineRE)
+  for (const line of lines) {
+    const m = line.match(lineRE)
     if (!m) {
       continue
     }
@@ -91,56 +63,122 @@ export async function getArticleStructures(notesDir: string, extension: string):
 
     // Lines with '*' bullet are considered root structures
     if (item === '*') {
+      const root: Structure = {
+        text,
+        slug: isLink ? slugifyArticleName(text) : null,
+        indent,
+        isLink,
+      }
+      // a root named again starts over
+      if (structures[text]) {
+        branches.forEach((names) => {
+          const i = names.indexOf(text)
+          if (i !== -1) {
+            names.splice(i, 1)
+          }
+        })
+      }
       rootText = text
       rootIndent = indent
       structures[text] = {
-        root: {
-          text,
-          slug: isLink ? slugifyArticleName(text) : null,
-          indent,
-          isLink,
-        },
+        root,
         tags: tags.trim().split('#').filter(v => v),
         structures: [],
       }
+      // indents in the tree are relative to the root, like in its branch
+      trees[text] = {...root, indent: 0, children: []}
+      stack = [trees[text]]
+      addBranch(branches, text, text)
+      continue
     }
 
     // If line is at the indent of the root, start looking for next root
-    if (item === '-' && indent <= rootIndent) {
+    if (rootText === null || indent <= rootIndent) {
       rootIndent = null
       rootText = null
       continue
     }
 
-    if (rootText && item === '-' && indent > rootIndent) {
-      structures[rootText].structures.push({
-        text,
-        slug: isLink ? slugifyArticleName(text) : null,
-        isLink,
-        indent: indent - rootIndent,
-      })
+    const structure: Structure = {
+      text,
+      slug: isLink ? slugifyArticleName(text) : null,
+      isLink,
+      indent: indent - rootIndent,
     }
+    structures[rootText].structures.push(structure)
+    addBranch(branches, text, rootText)
+
+    while (stack.length > 1 && stack[stack.length - 1].indent >= structure.indent) {
+      stack.pop()
+    }
+    const node = {...structure, children: []}
+    stack[stack.length - 1].children.push(node)
+    stack.push(node)
   }
 
-  return structures
+  return {structures, trees, branches}
 }
 
-export function getMatchingStructures(articleName: string, structures: Structures): Structures[keyof Structures][] {
-  const matchingBranches = []
-  const slug = slugifyArticleName(articleName)
-  for (const branch of Object.values(structures)) {
-    if (compareArticleNames(branch.root.text, articleName)) {
-      matchingBranches.push(branch)
-      break
+/**
+ * Structures of `notesDir`, parsed again only when structure.zortex changed
+ */
+export async function getStructureIndex(notesDir: string, extension: string): Promise<StructureIndex> {
+  const filepath = path.join(notesDir, 'structure' + extension)
+  let stat: fs.Stats
+  try {
+    stat = await fs.promises.stat(filepath)
+  } catch (e) {
+    if (e.code !== 'ENOENT') {
+      throw e
     }
+    delete caches[filepath]
+    return parseStructures([])
+  }
 
-    for (const structure of branch.structures) {
-      if (compareArticle(structure.text, slug)) {
-        matchingBranches.push(branch)
-        break
-      }
-    }
+  const cached = caches[filepath]
+  if (cached && cached.mtimeMs === stat.mtimeMs && cached.size === stat.size) {
+    return cached.index
+  }
+  const lines = (await fs.promises.readFile(filepath)).toString().split(/\r?\n/)
+  const index = parseStructures(lines)
+  caches[filepath] = {mtimeMs: stat.mtimeMs, size: stat.size, index}
+  return index
+}
+
+export function snapshotStructures(notesDir: string, extension: string): StructuresSnapshot | null {
+  return caches[path.join(notesDir, 'structure' + extension)] || null
+}
+
+/**
+ * Use a saved index until structure.zortex changes
+ */
+export function restoreStructures(notesDir: string, extension: string, snapshot: StructuresSnapshot) {
+  const filepath = path.join(notesDir, 'structure' + extension)
+  if (!caches[filepath]) {
+    caches[filepath] = snapshot
   }
+}
+
+export async function getArticleStructures(notesDir: string, extension: string): Promise<Structures> {
+  return (await getStructureIndex(notesDir, extension)).structures
+}
 
-  return matchingBranches
+/**
+ * Root structures whose root or branch names the article, in file order
+ */
+export function getMatchingStructures(articleName: string, index: StructureIndex): Structures[keyof Structures][] {
+  const names = index.branches.get(slugifyArticleName(articleName).toLowerCase()) || []
+  return names.map((name) => index.structures[name])
+}
+
+/**
+ * Lines of the matching structures as shown in the structures buffer
+ */
+export function renderStructures(branches: Structures[keyof Structures][]): string[] {
+  const itemText = (structure: Structure) => (structure.isLink ? `[${structure.text}]` : structure.text)
+  return branches.flatMap((branch) => [
+    `- ${itemText(branch.root)}`,
+    ...branch.structures.map((structure) => `${' '.repeat(structure.indent)}- ${itemText(structure)}`),
+    '',
+  ])
 }
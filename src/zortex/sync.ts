@@ -0,0 +1,331 @@
+import * as child_process from 'child_process'
+import * as crypto from 'crypto'
+import * as fs from 'fs'
+import * as os from 'os'
+import * as path from 'path'
+import * as readline from 'readline'
+import {refreshArticles} from './catalog'
+import {getZettels} from './store'
+
+const logger = require('../util/logger')('zortex/sync') // tslint:disable-line
+
+/*
+ * Sync a notes directory to the remote wiki by sending only the files which
+ * changed since the last sync.
+ *
+ * The journal of a remote, saved next to the snapshots, holds the mtime and
+ * size of each file as last sent. A sync sends one batch of JSON lines, the
+ * files whose mtime or size differ and the files gone since, through ssh to
+ * the remote server's /zortex/sync endpoint, which applies them to its notes
+ * directory and its indexes in memory. The ssh connection is shared by
+ * syncs for a while, so most don't pay for a handshake.
+ *
+ * The endpoint only accepts requests from the remote host itself carrying
+ * the token kept in the remote server's directory, which only ssh users can
+ * read.
+ */
+
+export interface SyncTarget {
+  // ssh destination
+  server: string
+  // directory of the remote server
+  dir: string
+  // port of the remote wiki
+  port: string | number
+}
+
+export type SyncChange =
+  | {op: 'put'; path: string; mtimeMs: number; data: string}
+  | {op: 'delete'; path: string}
+
+export interface SyncResult {
+  written: number
+  deleted: number
+}
+
+export interface JournalEntry {
+  mtimeMs: number
+  size: number
+}
+
+export type Journal = {[relativePath: string]: JournalEntry}
+
+// number of files stat'ed or read at the same time
+const CONCURRENCY = 32
+// time an idle ssh connection is kept open for the next sync
+const CONTROL_PERSIST = '10m'
+
+const TOKEN_FILE = '.sync-token'
+export const TOKEN_HEADER = 'x-zortex-sync'
+
+const loopbackAddresses = new Set(['127.0.0.1', '::1', '::ffff:127.0.0.1'])
+let token: Promise<string> = null
+
+// sync in progress, per journal
+const syncs: {[journalPath: string]: Promise<SyncResult>} = {}
+
+function journalPath(notesDir: string, target: SyncTarget) {
+  const cacheDir = process.env.XDG_CACHE_HOME || path.join(os.homedir(), '.cache')
+  const name = crypto
+    .createHash('sha1')
+    .update(`${path.resolve(notesDir)}\0${target.server}:${target.dir}`)
+    .digest('hex')
+    .slice(0, 16)
+  return path.join(cacheDir, 'zortex', `${name}.sync.json`)
+}
+
+async function readJournal(filepath: string): Promise<Journal> {
+  try {
+    return JSON.parse((await fs.promises.readFile(filepath)).toString())
+  } catch (e) {
+    if (e.code !== 'ENOENT') {
+      logger.error('read journal: ', e)
+    }
+    return {}
+  }
+}
+
+async function writeJournal(filepath: string, journal: Journal) {
+  const tmpFilepath = `${filepath}.${process.pid}`
+  await fs.promises.mkdir(path.dirname(filepath), {recursive: true})
+  await fs.promises.writeFile(tmpFilepath, JSON.stringify(journal))
+  await fs.promises.rename(tmpFilepath, filepath)
+}
+
+// files of `dir` relative to it, with / separators
+async function listFiles(dir: string, prefix = ''): Promise<string[]> {
+  const items = await fs.promises.readdir(path.join(dir, prefix), {withFileTypes: true})
+  const nested = await Promise.all(
+    items.map((item) => {
+      const relativePath = prefix ? `${prefix}/${item.name}` : item.name
+      if (item.isDirectory()) {
+        return listFiles(dir, relativePath)
+      }
+      return Promise.resolve(item.isFile() ? [relativePath] : [])
+    })
+  )
+  return nested.flat()
+}
+
+/**
+ * Files of `notesDir` changed since `journal` was written, and the journal
+ * as of these changes
+ */
+export async function collectChanges(notesDir: string, journal: Journal) {
+  const files = await listFiles(notesDir)
+  const current: Journal = {}
+  const puts: {path: string; stat: fs.Stats}[] = []
+
+  let next = 0
+  const worker = async () => {
+    while (next < files.length) {
+      const relativePath = files[next++]
+      try {
+        const stat = await fs.promises.stat(path.join(notesDir, relativePath))
+        current[relativePath] = {mtimeMs: stat.mtimeMs, size: stat.size}
+        const sent = journal[relativePath]
+        if (!sent || sent.mtimeMs !== stat.mtimeMs || sent.size !== stat.size) {
+          puts.push({path: relativePath, stat})
+        }
+      } catch (e) {
+        if (e.code !== 'ENOENT') {
+          throw e
+        }
+      }
+    }
+  }
+  await Promise.all(Array.from({length: Math.min(CONCURRENCY, files.length)}, worker))
+
+  const deletes = Object.keys(journal).filter((relativePath) => !current[relativePath])
+  return {puts, deletes, journal: current}
+}
+
+const shellQuote = (arg: string) => `'${arg.replace(/'/g, `'\\''`)}'`
+
+function sshArgs(target: SyncTarget) {
+  const controlPath = path.join(os.tmpdir(), 'zortex-ssh-%C')
+  const url = `http://127.0.0.1:${Number(target.port)}/zortex/sync`
+  return [
+    '-C',
+    '-o', 'BatchMode=yes',
+    '-o', 'ControlMaster=auto',
+    '-o', `ControlPath=${controlPath}`,
+    '-o', `ControlPersist=${CONTROL_PERSIST}`,
+    target.server,
+    `cd ${shellQuote(target.dir)} && curl -sSf -X POST -H "${TOKEN_HEADER}: $(cat ${TOKEN_FILE})" --data-binary @- ${url}`,
+  ]
+}
+
+// send changes as JSON lines to the remote endpoint, resolve to its answer
+async function send(notesDir: string, target: SyncTarget, puts: {path: string}[], deletes: string[]) {
+  const ssh = child_process.spawn('ssh', sshArgs(target), {stdio: ['pipe', 'pipe', 'pipe']})
+  const stdout: Buffer[] = []
+  const stderr: Buffer[] = []
+  ssh.stdout.on('data', (data) => stdout.push(data))
+  ssh.stderr.on('data', (data) => stderr.push(data))
+  const exit = new Promise<number>((resolve, reject) => {
+    ssh.on('error', reject)
+    ssh.on('close', resolve)
+  })
+
+  const write = (change: SyncChange) =>
+    new Promise<void>((resolve) => {
+      if (ssh.stdin.write(JSON.stringify(change) + '\n')) {
+        resolve()
+      } else {
+        ssh.stdin.once('drain', resolve)
+      }
+    })
+  // the remote side closed early, its exit code tells why
+  ssh.stdin.on('error', () => undefined)
+
+  try {
+    for (const {path: relativePath} of puts) {
+      const filepath = path.join(notesDir, relativePath)
+      const stat = await fs.promises.stat(filepath)
+      const data = (await fs.promises.readFile(filepath)).toString('base64')
+      await write({op: 'put', path: relativePath, mtimeMs: stat.mtimeMs, data})
+    }
+    for (const relativePath of deletes) {
+      await write({op: 'delete', path: relativePath})
+    }
+  } finally {
+    ssh.stdin.end()
+  }
+
+  const code = await exit
+  if (code !== 0) {
+    throw new Error(`sync to ${target.server} failed (${code}): ${Buffer.concat(stderr).toString().trim()}`)
+  }
+  return JSON.parse(Buffer.concat(stdout).toString()) as SyncResult
+}
+
+async function sync(notesDir: string, target: SyncTarget, filepath: string): Promise<SyncResult> {
+  const {puts, deletes, journal} = await collectChanges(notesDir, await readJournal(filepath))
+  if (puts.length === 0 && deletes.length === 0) {
+    return {written: 0, deleted: 0}
+  }
+  const result = await send(notesDir, target, puts, deletes)
+  // files changed while sending differ from the journal and are sent again
+  await writeJournal(filepath, journal)
+  return result
+}
+
+/**
+ * Send the files of `notesDir` changed since the last sync to `target`
+ */
+export function syncNotes(notesDir: string, target: SyncTarget): Promise<SyncResult> {
+  const filepath = journalPath(notesDir, target)
+  if (!syncs[filepath]) {
+    syncs[filepath] = sync(notesDir, target, filepath).finally(() => {
+      delete syncs[filepath]
+    })
+  }
+  return syncs[filepath]
+}
+
+export function isLoopback(address: string | undefined) {
+  return loopbackAddresses.has(address)
+}
+
+/**
+ * Token of the server running in `dir`, created on first use
+ */
+export function syncToken(dir: string) {
+  if (!token) {
+    const filepath = path.join(dir, TOKEN_FILE)
+    token = fs.promises
+      .readFile(filepath)
+      .then((data) => data.toString().trim())
+      .catch(async (e) => {
+        if (e.code !== 'ENOENT') {
+          throw e
+        }
+        const created = crypto.randomBytes(24).toString('hex')
+        await fs.promises.writeFile(filepath, created + '\n', {mode: 0o600, flag: 'wx'})
+        return created
+      })
+    token.catch(() => {
+      token = null
+    })
+  }
+  return token
+}
+
+/**
+ * Whether `received` is the sync token of the server running in `dir`
+ */
+export async function checkToken(dir: string, received: string | string[] | undefined) {
+  if (typeof received !== 'string') {
+    return false
+  }
+  const expected = Buffer.from(await syncToken(dir))
+  const actual = Buffer.from(received.trim())
+  return expected.length > 0 && expected.length === actual.length && crypto.timingSafeEqual(expected, actual)
+}
+
+// path of a synced file under `notesDir`, null if it would land outside
+function resolvePath(notesDir: string, relativePath: string) {
+  if (typeof relativePath !== 'string' || relativePath === '' || path.isAbsolute(relativePath)) {
+    return null
+  }
+  const segments = relativePath.split(/[\\/]/)
+  if (segments.some((segment) => segment === '' || segment === '.' || segment === '..')) {
+    return null
+  }
+  return path.join(notesDir, ...segments)
+}
+
+async function applyChange(notesDir: string, change: SyncChange) {
+  const filepath = resolvePath(notesDir, change.path)
+  if (!filepath) {
+    throw new Error(`invalid path: ${change.path}`)
+  }
+  if (change.op === 'put') {
+    // hidden so the catalog doesn't take it for the article being replaced
+    const tmpFilepath = path.join(path.dirname(filepath), `.${path.basename(filepath)}.${process.pid}.sync`)
+    await fs.promises.mkdir(path.dirname(filepath), {recursive: true})
+    await fs.promises.writeFile(tmpFilepath, Buffer.from(change.data, 'base64'))
+    const mtime = new Date(change.mtimeMs)
+    await fs.promises.utimes(tmpFilepath, mtime, mtime)
+    await fs.promises.rename(tmpFilepath, filepath)
+  } else if (change.op === 'delete') {
+    await fs.promises.rm(filepath, {force: true})
+  } else {
+    throw new Error(`invalid change: ${(change as any).op}`)
+  }
+}
+
+/**
+ * Apply the JSON lines of `input` to `notesDir`, then bring the indexes kept
+ * in memory up to date with them
+ */
+export async function applyChanges(
+  notesDir: string,
+  extension: string,
+  input: NodeJS.ReadableStream
+): Promise<SyncResult> {
+  const result: SyncResult = {written: 0, deleted: 0}
+  const articles: string[] = []
+  const lines = readline.createInterface({input, crlfDelay: Infinity})
+  for await (const line of lines) {
+    if (line.length === 0) {
+      continue
+    }
+    const change: SyncChange = JSON.parse(line)
+    await applyChange(notesDir, change)
+    if (change.op === 'put') {
+      result.written++
+    } else {
+      result.deleted++
+    }
+    // articles are the files at the top of the notes directory
+    if (!change.path.includes('/')) {
+      articles.push(change.path)
+    }
+  }
+
+  await refreshArticles(notesDir, articles)
+  await getZettels(path.join(notesDir, 'zettels' + extension)).catch((e) => logger.error('zettels: ', e))
+  return result
+}
@@ -2,20 +2,6 @@ import {Interface} from 'readline'
 
 export type Lines = Interface | string[]
 
-// export type Structures = {
-//   [name: string]: {
-//     root: Structure
-//     tags: string[]
-//   }
-// }
-
-// export interface Structure {
-//   text: string
-//   slug: string
-//   isLink: boolean
-//   structures: Structure[]
-// }
-
 export type Structures = {
   [name: string]: {
     root: Structure
@@ -31,10 +17,23 @@ export interface Structure {
   isLink: boolean
 }
 
+// A structure and the structures nested under it
+export interface StructureNode extends Structure {
+  children: StructureNode[]
+}
+
+
+// Zettels with any of `tags`, or with none of them when negated
+export interface QueryClause {
+  tags: string[]
+  negate: boolean
+}
 
 export interface Query {
   indent: number
+  // every tag mentioned by the query
   tags: string[]
+  clauses: QueryClause[]
 }
 
 export interface Articles {
@@ -44,12 +43,18 @@ export interface Articles {
 }
 
 export interface Zettels {
+  // bumped whenever zettels are added or removed in place
+  version?: number
   tags: {[tag: string]: Set<string>}
+  // tag -> number of zettels it shares with each other tag, kept by the store
+  related?: {[tag: string]: Map<string, number>}
   ids: {
     [id: string]: {
       tags: Set<string>
       content: string | string[]
       lineNumber: number
+      // file name of the shard holding the zettel, when zettels are sharded
+      shard?: string
     }
   }
 }
@@ -60,6 +65,9 @@ export interface Env {
   onlyTags: boolean
   relatedTags: boolean
   repl: boolean
+  // answer JSON lines on stdio, or on a Unix socket at `socket`
+  batch: boolean
+  socket: string | null
   missingTags: boolean
   command?: string
 
@@ -1,8 +1,8 @@
 import * as fs from 'fs'
 import * as path from 'path'
-import {indexZettels, populateHub} from './zettel'
-
-import {getArticleTitle} from './helpers'
+import {getPopulatedArticle} from './hub'
+import {getZettels} from './store'
+import {getCatalogArticles} from './catalog'
 
 export interface Article {
   title: string
@@ -51,26 +51,11 @@ export function parseArticleTitle(titleLine: string) {
   }
 }
 
-export async function getArticles(notesDir: string): Promise<Articles> {
-  const articles = {}
-
-  // get article names
-  const fileNames = fs
-    .readdirSync(notesDir, {withFileTypes: true})
-    .filter((item) => !item.isDirectory())
-    .map((item) => item.name)
-
-  for await (const fileName of fileNames) {
-    const article = await getArticleTitle(path.join(notesDir, fileName))
-
-    articles[article.slug] = {
-      title: article.title,
-      fileName,
-      slug: article.slug,
-    }
-  }
-
-  return articles
+/**
+ * Articles of `notesDir` by slug, kept current as notes are added or renamed
+ */
+export function getArticles(notesDir: string): Promise<Articles> {
+  return getCatalogArticles(notesDir)
 }
 
 export function matchArticle(
@@ -116,13 +101,14 @@ export function searchArticles(articles: Articles, search: string) {
 }
 
 export async function findArticle(notesDir: string, extension: string, articleName: string, articles: Articles) {
-  const article = matchArticle(notesDir, articleName, articles)
+  const article = articles[slugifyArticleName(articleName)]
   if (!article) {
     return null
   }
 
-  const zettels = await indexZettels(path.join(notesDir, 'zettels' + extension))
-  const content = await populateHub(article.content, zettels, notesDir)
+  const zettelsFile = path.join(notesDir, 'zettels' + extension)
+  const zettels = await getZettels(zettelsFile)
+  const content = await getPopulatedArticle(path.join(notesDir, article.fileName), zettelsFile, zettels, notesDir)
 
   return {
     articleName,
@@ -0,0 +1,111 @@
+import * as os from 'os'
+import * as path from 'path'
+import {Worker} from 'worker_threads'
+import {Zettels} from './types'
+import type {Entry} from './store'
+
+const logger = require('../util/logger')('zortex/workers') // tslint:disable-line
+
+/*
+ * Pool of worker threads parsing zettels files in parallel.
+ *
+ * Workers are started on first use and only keep the process alive while
+ * they parse. If a
+ * worker can't be started or crashes, parseInWorker rejects with
+ * WorkerUnavailable and callers parse on the main thread instead.
+ */
+
+interface Job {
+  id: number
+  source: Buffer
+  resolve: (result: {entries: Entry[]; zettels: Zettels}) => void
+  reject: (error: Error) => void
+}
+
+interface PoolWorker {
+  worker: Worker
+  job: Job | null
+}
+
+export class WorkerUnavailable extends Error {}
+
+const POOL_SIZE = Math.max(1, Math.min(os.cpus().length - 1, 4))
+
+const workers: PoolWorker[] = []
+const queue: Job[] = []
+let nextId = 0
+// set once a worker failed, the pool isn't used again
+let unavailable = false
+
+function failAll(error: Error) {
+  unavailable = true
+  workers.forEach((poolWorker) => {
+    poolWorker.job?.reject(new WorkerUnavailable(error.message))
+    poolWorker.worker.terminate()
+  })
+  workers.length = 0
+  queue.splice(0).forEach((job) => job.reject(new WorkerUnavailable(error.message)))
+}
+
+function startWorker(): PoolWorker {
+  const poolWorker: PoolWorker = {
+    worker: new Worker(path.join(__dirname, 'indexWorker.js')),
+    job: null,
+  }
+  poolWorker.worker.unref()
+  poolWorker.worker.on('message', ({id, error, entries, zettels}) => {
+    const job = poolWorker.job
+    poolWorker.job = null
+    poolWorker.worker.unref()
+    if (job?.id === id) {
+      if (error) {
+        job.reject(new Error(error))
+      } else {
+        job.resolve({entries, zettels})
+      }
+    }
+    dispatch()
+  })
+  poolWorker.worker.on('error', (e) => {
+    logger.error('index worker: ', e)
+    failAll(e)
+  })
+  return poolWorker
+}
+
+function dispatch() {
+  while (queue.length > 0) {
+    let poolWorker = workers.find((w) => !w.job)
+    if (!poolWorker && workers.length < POOL_SIZE) {
+      try {
+        poolWorker = startWorker()
+      } catch (e) {
+        logger.error('start index worker: ', e)
+        failAll(e)
+        return
+      }
+      workers.push(poolWorker)
+    }
+    if (!poolWorker) {
+      return
+    }
+    const job = queue.shift()
+    poolWorker.job = job
+    // keep the process alive until the job is done
+    poolWorker.worker.ref()
+    poolWorker.worker.postMessage({id: job.id, source: job.source})
+  }
+}
+
+/**
+ * Entries and zettels of a zettels file, parsed on a worker thread
+ */
+export function parseInWorker(source: Buffer): Promise<{entries: Entry[]; zettels: Zettels}> {
+  if (unavailable) {
+    return Promise.reject(new WorkerUnavailable('index workers failed'))
+  }
+  return new Promise((resolve, reject) => {
+    queue.push({id: nextId++, source, resolve, reject})
+    dispatch()
+  })
+}
@@ -4,6 +4,7 @@ import * as fs from 'fs'
 import strftime from 'strftime'
 import {Articles, Zettels, Lines} from './types'
 import {readLines} from './helpers'
+import {readHeaderLines} from './catalog'
 import {isQuery, fetchQuery, parseQuery} from './query'
 
 export function newZettelId() {
@@ -16,10 +17,12 @@ export function toZettel(
   tags: string[],
   content: string | string[]
 ) {
+  // `##` would be parsed as an empty tag
+  const header = tags.length > 0 ? `[${id}] #${tags.join('#')}#` : `[${id}]`
   if (typeof content === 'string') {
-    return `[${id}] #${tags.join('#')}# ${content}`
+    return `${header} ${content}`
   } else {
-    return `[${id}] #${tags.join('#')}# ${content.join('\n')}`
+    return `${header} ${content.join('\n')}`
   }
 }
 
@@ -33,6 +36,23 @@ function showZettel(id: string, tags: string[], content: string | string[]) {
   }
 }
 
+/**
+ * JSON friendly form of a zettel, `Set`s don't serialize
+ */
+export function serializeZettel(id: string, zettels: Zettels) {
+  const zettel = zettels.ids[id]
+  if (!zettel) {
+    return null
+  }
+
+  return {
+    id,
+    tags: [...zettel.tags],
+    content: zettel.content,
+    lineNumber: zettel.lineNumber,
+  }
+}
+
 export function showZettels(ids: string[], zettels: Zettels) {
   for (const id of ids) {
     const zettel = zettels.ids[id]
@@ -40,6 +60,12 @@ export function showZettels(ids: string[], zettels: Zettels) {
   }
 }
 
+export const zettelRE = /^\[(z:[0-9.]*)]\s*(#.*#)?\s*(.*)$/
+
+export function parseZettelTags(tags: string | undefined): Set<string> {
+  return new Set(tags ? tags.replace(/^#|#$/g, '').split('#') : [])
+}
+
 export async function indexZettels(zettelsFile: string): Promise<Zettels> {
   let lineNumber = 0
   let id: string
@@ -49,7 +75,6 @@ export async function indexZettels(zettelsFile: string): Promise<Zettels> {
     tags: {},
     ids: {},
   }
-  const zettelRE = /^\[(z:[0-9.]*)]\s*(#.*#)?\s*(.*)$/
   const lines = readLines(zettelsFile)
 
   for await (const line of lines) {
@@ -75,7 +100,7 @@ export async function indexZettels(zettelsFile: string): Promise<Zettels> {
     //     }
 
     id = match[1]
-    tags = new Set(match[2] ? match[2].replace(/^#|#$/g, '').split('#') : [])
+    tags = parseZettelTags(match[2])
     content = match[3] ? match[3] : []
 
     if (zettels.ids[id]) {
@@ -117,18 +142,23 @@ export async function populateHub(lines: Lines, zettels: Zettels, notesDir: stri
 
     // Fetch zettels and add them to the hub
     const query = parseQuery(line)
+    if (!query) {
+      newLines.push(line)
+      continue
+    }
     const results = fetchQuery(query, zettels)
 
     // Populate file with query responses
-    const resultZettels = results.map((id) => zettels.ids[id])
-    for (const zettel of resultZettels) {
-      if (Array.isArray(zettel.content)) {
-        newLines.push(`${' '.repeat(query.indent)}- ${zettel.content[0]}`)
-        for (const line of zettel.content.slice(1)) {
-          newLines.push(`${' '.repeat(query.indent)}${line}`)
+    const indent = ' '.repeat(query.indent)
+    for (const id of results) {
+      const content = zettels.ids[id].content
+      if (Array.isArray(content)) {
+        newLines.push(`${indent}- ${content[0]}`)
+        for (let i = 1; i < content.length; i++) {
+          newLines.push(indent + content[i])
         }
       } else {
-        newLines.push(`${' '.repeat(query.indent)}- ${zettel.content}`)
+        newLines.push(`${indent}- ${content}`)
       }
     }
   }
@@ -172,39 +202,75 @@ export async function indexCategories(categoriesFileName: string) {
 
 const articleRE = /.zortex/
 const tagRE = /^([A-Z][a-z]*)?(@+)(.*)$/
-export async function indexArticles(projectDir: string) {
-  let match: RegExpMatchArray
+
+// number of article headers read at the same time
+const ARTICLE_CONCURRENCY = 32
+
+// header lines of each article as of its mtime and size, per notes directory
+const articleHeaders: {[projectDir: string]: Map<string, {mtimeMs: number; size: number; lines: string[]}>} = {}
+
+async function readArticleHeader(projectDir: string, file: string) {
+  const headers = articleHeaders[projectDir] || (articleHeaders[projectDir] = new Map())
+  const filepath = path.join(projectDir, file)
+  const stat = await fs.promises.stat(filepath)
+  const cached = headers.get(file)
+  if (cached && cached.mtimeMs === stat.mtimeMs && cached.size === stat.size) {
+    return cached.lines
+  }
+  // tags and names up to the first other line, blank lines don't end it
+  const lines = (await readHeaderLines(filepath, (line) => line.length === 0 || tagRE.test(line)))
+    .filter((line) => line.length > 0)
+  headers.set(file, {mtimeMs: stat.mtimeMs, size: stat.size, lines})
+  return lines
+}
+
+/**
+ * Names and tags of the articles of `projectDir`, read `concurrency` files
+ * at a time. Headers of files which didn't change since the previous call
+ * aren't read again.
+ */
+export async function indexArticles(projectDir: string, concurrency = ARTICLE_CONCURRENCY): Promise<Articles> {
   const articles: Articles = {names: new Set(), tags: new Set(), ids: {}}
+  const files = (await fs.promises.readdir(projectDir)).filter((file) => articleRE.test(file))
+  const headers: string[][] = new Array(files.length)
 
-  await Promise.all(
-    fs.readdirSync(projectDir).map(async (file) => {
-      if (!articleRE.test(file)) {
-        return
+  let next = 0
+  const worker = async () => {
+    while (next < files.length) {
+      const i = next++
+      try {
+        headers[i] = await readArticleHeader(projectDir, files[i])
+      } catch (e) {
+        // removed or not a file
+        headers[i] = []
       }
+    }
+  }
+  await Promise.all(Array.from({length: Math.min(concurrency, files.length)}, worker))
 
-      for await (const line of readLines(path.join(projectDir, file))) {
-        match = line.match(tagRE)
-        if (line.length === 0) {
-          continue
-        }
-        if (!match) {
-          return
-        }
+  const fileSet = new Set(files)
+  for (const file of articleHeaders[projectDir]?.keys() || []) {
+    if (!fileSet.has(file)) {
+      articleHeaders[projectDir].delete(file)
+    }
+  }
 
-        if (!articles.ids[file]) {
-          articles.ids[file] = {name: null, tags: []}
-        }
+  files.forEach((file, i) => {
+    for (const line of headers[i]) {
+      const match = line.match(tagRE)
+      if (!articles.ids[file]) {
+        articles.ids[file] = {name: null, tags: []}
+      }
 
-        if (match[2].length === 1) {
-          articles.tags.add(match[3])
-          articles.ids[file].tags.push(match[3])
-        } else {
-          articles.names.add(match[3])
-          articles.ids[file].name = match[3]
-        }
+      if (match[2].length === 1) {
+        articles.tags.add(match[3])
+        articles.ids[file].tags.push(match[3])
+      } else {
+        articles.names.add(match[3])
+        articles.ids[file].name = match[3]
       }
-    })
-  )
+    }
+  })
 
   return articles
 }